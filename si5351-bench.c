@@ -0,0 +1,377 @@
+/* microbenchmarks for the Si5351 frequency planning library
+ *
+ * Copyright 2024, Franco Venturi, K4VZ
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "si5351plan.h"
+#include "si5351embedded.h"
+
+/* every workload uses fixed inputs (a seeded xorshift generator) and a
+ * fixed number of calls, so the checksum of the results only changes when
+ * the results do; one line per workload:
+ *
+ *     name calls checksum ns/call calls/sec iterations/call [baseline ns/call ratio [baseline iterations/call]]
+ *
+ * where iterations are the solver counters of the library (continued
+ * fraction terms, semiconvergents, scenario candidates and optimizer
+ * evaluations, see struct si5351_stats), so that a change that does fewer
+ * iterations can be told from one that makes each of them cheaper; they
+ * are only counted when the library is built with -DSI5351_STATS (make
+ * bench BENCH_STATS=1) and are "-" otherwise. Given the output of a
+ * previous run, the last columns compare against it
+ */
+
+static const uint32_t MAX_DENOMINATOR = 1048575;
+
+struct workload {
+    const char *name;
+    uint32_t calls;
+    /* runs the workload once; returns the checksum */
+    uint64_t (*run)(uint32_t calls);
+};
+
+static uint64_t xorshift64(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+/* uniform in [min, max) */
+static double uniform(uint64_t *state, double min, double max)
+{
+    return min + (max - min) * (double)(xorshift64(state) >> 11) / 9007199254740992.0;
+}
+
+static uint64_t mix(uint64_t checksum, uint32_t a, uint32_t b, uint32_t c)
+{
+    checksum ^= ((uint64_t)a << 40) ^ ((uint64_t)b << 20) ^ c;
+    return checksum * 0x100000001b3ULL;
+}
+
+static uint64_t mix_plan(uint64_t checksum, const struct si5351_plan_result *plan)
+{
+    for (int pll = SI5351_PLLA; pll <= SI5351_PLLB; pll++)
+        checksum = mix(checksum, plan->feedback[pll].a, plan->feedback[pll].b, plan->feedback[pll].c);
+    for (int nclk = 0; nclk < plan->nclks; nclk++)
+        checksum = mix(checksum, plan->output[nclk].a, plan->output[nclk].b, plan->output[nclk].c);
+    return checksum;
+}
+
+static uint64_t approximation(uint32_t calls, double min, double max)
+{
+    uint64_t state = 0x5351;
+    uint64_t checksum = 0;
+    for (uint32_t i = 0; i < calls; i++) {
+        uint32_t a, b, c;
+        si5351_rational_approximation(uniform(&state, min, max), MAX_DENOMINATOR, &a, &b, &c);
+        checksum = mix(checksum, a, b, c);
+    }
+    return checksum;
+}
+
+static uint64_t approximation_output(uint32_t calls)
+{
+    return approximation(calls, 4, 900);
+}
+
+static uint64_t approximation_feedback(uint32_t calls)
+{
+    return approximation(calls, 15, 90);
+}
+
+/* n +/- tiny fractions: a huge second partial quotient */
+static uint64_t approximation_near_integer(uint32_t calls)
+{
+    uint64_t state = 0x5351;
+    uint64_t checksum = 0;
+    for (uint32_t i = 0; i < calls; i++) {
+        double n = 15 + (double)(xorshift64(&state) % 76);
+        double epsilon = uniform(&state, 1e-12, 1e-7);
+        uint32_t a, b, c;
+        si5351_rational_approximation(i % 2 ? n + epsilon : n - epsilon, MAX_DENOMINATOR, &a, &b, &c);
+        checksum = mix(checksum, a, b, c);
+    }
+    return checksum;
+}
+
+/* output MS of integer Hz clocks from 1kHz-grid VCOs */
+static uint64_t approximation_exact(uint32_t calls)
+{
+    uint64_t state = 0x5351;
+    uint64_t checksum = 0;
+    for (uint32_t i = 0; i < calls; i++) {
+        uint64_t vco = 600000000 + (xorshift64(&state) % 400000) * 1000;
+        uint64_t clk = 1000000 + xorshift64(&state) % 199000000;
+        if (vco / clk < 4 || vco / clk > 899)
+            clk = vco / 100 + 1;
+        uint32_t a, b, c;
+        si5351_rational_approximation_exact(vco, clk, MAX_DENOMINATOR, &a, &b, &c);
+        checksum = mix(checksum, a, b, c);
+    }
+    return checksum;
+}
+
+/* the frequency sets of the README examples */
+static const struct si5351_plan_request examples[] = {
+    {25000000, 2, {4687500, 66672000}},
+    {27000000, 2, {4687500, 66672000}},
+    {25000000, 2, {10000000, 66672000}},
+    {27000000, 2, {10000000, 66672000}},
+};
+#define NEXAMPLES (sizeof(examples) / sizeof(examples[0]))
+
+static uint64_t plan_examples(uint32_t calls)
+{
+    uint64_t checksum = 0;
+    for (uint32_t i = 0; i < calls; i++) {
+        /* a fresh setup each time: no reuse across calls */
+        struct si5351_setup setup = {0};
+        struct si5351_plan_result plan;
+        if (si5351_plan(&setup, &examples[i % NEXAMPLES], &plan) == SI5351_OK)
+            checksum = mix_plan(checksum, &plan);
+    }
+    return checksum;
+}
+
+static uint64_t plan_first_examples(uint32_t calls)
+{
+    uint64_t checksum = 0;
+    for (uint32_t i = 0; i < calls; i++) {
+        struct si5351_setup setup = {0};
+        struct si5351_plan_result plan;
+        if (si5351_plan_first(&setup, &examples[i % NEXAMPLES], 0, &plan) == SI5351_OK)
+            checksum = mix_plan(checksum, &plan);
+    }
+    return checksum;
+}
+
+static uint64_t optimize_examples(uint32_t calls)
+{
+    struct si5351_optimize_options options;
+    si5351_optimize_defaults(&options);
+    uint64_t checksum = 0;
+    for (uint32_t i = 0; i < calls; i++) {
+        struct si5351_setup setup = {0};
+        struct si5351_plan_result plan;
+        if (si5351_optimize(&setup, &examples[i % NEXAMPLES], &options, &plan) > 0)
+            checksum = mix_plan(checksum, &plan);
+    }
+    return checksum;
+}
+
+/* 8 clocks (CLK6 and CLK7 integer only) across both PLLs */
+static uint64_t optimize_8_clocks(uint32_t calls)
+{
+    static const struct si5351_plan_request request = {
+        25000000, 8, {4687500, 66672000, 14318180, 10000000, 7100000, 3579545, 12000000, 27000000}
+    };
+    struct si5351_optimize_options options;
+    si5351_optimize_defaults(&options);
+    uint64_t checksum = 0;
+    for (uint32_t i = 0; i < calls; i++) {
+        struct si5351_setup setup = {0};
+        struct si5351_plan_result plan;
+        if (si5351_optimize(&setup, &request, &options, &plan) > 0)
+            checksum = mix_plan(checksum, &plan);
+    }
+    return checksum;
+}
+
+/* 7.000-7.300MHz in 1kHz steps with the same setup */
+static uint64_t plan_sweep(uint32_t calls)
+{
+    struct si5351_setup setup = {0};
+    uint64_t checksum = 0;
+    for (uint32_t i = 0; i < calls; i++) {
+        struct si5351_plan_request request = {25000000, 1, {7000000 + (i % 301) * 1000}};
+        struct si5351_plan_result plan;
+        if (si5351_plan(&setup, &request, &plan) == SI5351_OK)
+            checksum = mix_plan(checksum, &plan);
+    }
+    return checksum;
+}
+
+/* the same sweep with the embedded planner */
+static uint64_t embedded_sweep(uint32_t calls)
+{
+    uint64_t checksum = 0;
+    for (uint32_t i = 0; i < calls; i++) {
+        struct si5351e_plan plan;
+        if (si5351e_plan(25000000, 7000000 + (i % 301) * 1000, &plan) == SI5351_OK) {
+            checksum = mix(checksum, plan.feedback.a, plan.feedback.b, plan.feedback.c);
+            checksum = mix(checksum, plan.output.a, plan.output.b, plan.output.c);
+        }
+    }
+    return checksum;
+}
+
+/* and with the xtal known at compile time */
+static uint64_t embedded_sweep_fixed(uint32_t calls)
+{
+    uint64_t checksum = 0;
+    for (uint32_t i = 0; i < calls; i++) {
+        struct si5351e_plan plan;
+        if (si5351e_plan_inline(25000000, 7000000 + (i % 301) * 1000, &plan) == SI5351_OK) {
+            checksum = mix(checksum, plan.feedback.a, plan.feedback.b, plan.feedback.c);
+            checksum = mix(checksum, plan.output.a, plan.output.b, plan.output.c);
+        }
+    }
+    return checksum;
+}
+
+/* AFC corrections of up to +/-500Hz around 7.074MHz from a fixed plan */
+static uint64_t fine_tune_afc(uint32_t calls)
+{
+    const struct si5351_plan_request request = {25000000, 1, {7074000}};
+    struct si5351_setup setup = {0};
+    struct si5351_plan_result plan;
+    struct si5351_fine_tune tune;
+    if (si5351_plan(&setup, &request, &plan) != SI5351_OK ||
+        si5351_fine_tune_init(&tune, &plan, request.xtal, 0) != SI5351_OK)
+        return 0;
+    uint64_t state = 0x5351;
+    uint64_t checksum = 0;
+    for (uint32_t i = 0; i < calls; i++) {
+        double clk = request.clks[0] + (double)(xorshift64(&state) % 1001) - 500;
+        if (si5351_fine_tune(&tune, clk, &plan) == SI5351_OK)
+            checksum = mix(checksum, plan.output[0].a, plan.output[0].b, plan.output[0].c);
+    }
+    return checksum;
+}
+
+/* xtal corrections of up to +/-20ppm for a fixed 3 clock plan */
+static uint64_t recalibrate_3_clocks(uint32_t calls)
+{
+    const struct si5351_plan_request request = {25000000, 3, {7074000, 10000000, 14074000}};
+    struct si5351_optimize_options options;
+    struct si5351_setup setup = {0};
+    struct si5351_plan_result plan;
+    si5351_optimize_defaults(&options);
+    if (si5351_optimize(&setup, &request, &options, &plan) < 1)
+        return 0;
+    uint64_t state = 0x5351;
+    uint64_t checksum = 0;
+    for (uint32_t i = 0; i < calls; i++) {
+        double xtal = request.xtal * (1 + ((double)(xorshift64(&state) % 40001) - 20000) / 1e9);
+        struct si5351_plan_result recalibrated;
+        if (si5351_recalibrate(&plan, xtal, &recalibrated) == SI5351_OK)
+            checksum = mix_plan(checksum, &recalibrated);
+    }
+    return checksum;
+}
+
+static const struct workload workloads[] = {
+    {"approximation_output", 1000000, approximation_output},
+    {"approximation_feedback", 1000000, approximation_feedback},
+    {"approximation_near_integer", 1000000, approximation_near_integer},
+    {"approximation_exact", 1000000, approximation_exact},
+    {"plan_examples", 2000, plan_examples},
+    {"plan_first_examples", 2000, plan_first_examples},
+    {"optimize_examples", 200, optimize_examples},
+    {"optimize_8_clocks", 20, optimize_8_clocks},
+    {"plan_sweep", 3010, plan_sweep},
+    {"embedded_sweep", 301000, embedded_sweep},
+    {"embedded_sweep_fixed", 301000, embedded_sweep_fixed},
+    {"fine_tune_afc", 1000000, fine_tune_afc},
+    {"recalibrate_3_clocks", 100000, recalibrate_3_clocks},
+};
+#define NWORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t iterations(const struct si5351_stats *stats)
+{
+    return stats->cf_terms + stats->semiconvergents + stats->candidates + stats->optimizer_evaluations;
+}
+
+/* ns/call and iterations/call of name in a previous output (0 if not
+ * found, iterations -1 if not counted or from an older output)
+ */
+static double baseline_ns(FILE *baseline, const char *name, double *iterations)
+{
+    char line[256];
+    char bname[64];
+    double ns;
+
+    *iterations = -1;
+    if (baseline == NULL)
+        return 0;
+    rewind(baseline);
+    while (fgets(line, sizeof(line), baseline) != NULL) {
+        if (sscanf(line, "%63s %*u %*s %lf", bname, &ns) == 2 && strcmp(bname, name) == 0) {
+            if (sscanf(line, "%*s %*u %*s %*f %*f %lf", iterations) != 1)
+                *iterations = -1;
+            return ns;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    FILE *baseline = NULL;
+    if (argc > 2) {
+        fprintf(stderr, "usage: %s [baseline]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (argc == 2) {
+        baseline = fopen(argv[1], "r");
+        if (baseline == NULL) {
+            perror(argv[1]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    for (size_t i = 0; i < NWORKLOADS; i++) {
+        const struct workload *workload = &workloads[i];
+
+        /* warm up, then the best of 3 runs */
+        uint64_t checksum = workload->run(workload->calls / 10 + 1);
+        double best = 0;
+        struct si5351_stats stats;
+        for (int run = 0; run < 3; run++) {
+            si5351_stats_reset();
+            double start = now();
+            checksum = workload->run(workload->calls);
+            double elapsed = now() - start;
+            if (run == 0)
+                si5351_stats_get(&stats);
+            if (run == 0 || elapsed < best)
+                best = elapsed;
+        }
+
+        double ns = best * 1e9 / workload->calls;
+        fprintf(stdout, "%s %u %016llx %.1f %.0f", workload->name, workload->calls, (unsigned long long)checksum, ns, workload->calls / best);
+        if (si5351_stats_enabled())
+            fprintf(stdout, " %.1f", (double)iterations(&stats) / workload->calls);
+        else
+            fprintf(stdout, " -");
+        double base_iterations;
+        double base = baseline_ns(baseline, workload->name, &base_iterations);
+        if (base > 0)
+            fprintf(stdout, " %.1f %.2f", base, ns / base);
+        if (base > 0 && base_iterations >= 0)
+            fprintf(stdout, " %.1f", base_iterations);
+        fprintf(stdout, "\n");
+    }
+
+    if (baseline != NULL)
+        fclose(baseline);
+    return EXIT_SUCCESS;
+}
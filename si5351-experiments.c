@@ -5,67 +5,348 @@
  * SPDX-License-Identifier: GPL-3.0-or-later
  */
 
-#include <math.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-#define MAX_CLOCKS 3
-
-static const double SI5351_MIN_VCO_FREQ = 600e6;
-static const double SI5351_MAX_VCO_FREQ = 1000e6;
-static const uint32_t SI5351_MAX_DENOMINATOR = 1048575;
-static const double SI5351_MIN_CLKIN_FREQ = 10e6;
-static const double SI5351_MAX_CLKIN_FREQ = 100e6;
+#include "si5351plan.h"
+#include "si5351-output.h"
+#include "si5351-server.h"
 
 static const double CLOCK_TOLERANCE = 1e-8;
+
+/* --stats: counters of the batch worker threads, printed at exit along
+ * with those of the main thread
+ */
+static struct si5351_stats worker_stats;
+static void print_stats(void);
  
+/* command line settings shared by the modes */
+struct cli_options {
+    uint32_t cache_size;        /* rational approximation cache entries */
+    int registers;              /* also print the register image */
+    int incremental;            /* batch: retune and print the register writes */
+    int jobs;                   /* batch: worker threads */
+    int format;                 /* enum output_format */
+    int best;                   /* listing: only the best K per scenario (0: all) */
+    int stats;                  /* print the solver counters at exit */
+    int first;                  /* batch: stop at the first plan within first_ppb */
+    double first_ppb;           /* 0: exact */
+    /* xtal correction of every request */
+    struct si5351_calibration calibration;
+    double xtal_measured;       /* Hz (0: use calibration.ppb) */
+    double temp;                /* for the calibration temperature table */
+    int recalibrate;            /* -O: also si5351_recalibrate() the plans */
+    double recalibrate_ppb;     /* to this calibration.ppb */
+    double recalibrate_xtal;
+};
 
-static void rational_approximation(double value, uint32_t max_denominator,
-                                   uint32_t *a, uint32_t *b, uint32_t *c);
+static void usage(const char *progname);
+static int read_temp_table(const char *filename, struct si5351_calibration *calibration);
+static int scratch_init(struct si5351_arena *arena, void **buffer, uint32_t cache_size,
+                        const struct si5351_optimize_options *options);
+static void calibrate_request(const struct cli_options *cli, struct si5351_plan_request *request);
+static void print_candidate(const struct si5351_plan_result *candidate, void *arg);
+static int optimize(const struct si5351_plan_request *request,
+                    const struct si5351_optimize_options *options,
+                    const struct cli_options *cli);
+static int list_scenario(int scenario, const struct si5351_setup *setup,
+                         const struct si5351_plan_request *request,
+                         const struct cli_options *cli,
+                         si5351_candidate_fn fn, void *arg);
+static int candidates(const struct si5351_plan_request *request,
+                      const struct cli_options *cli);
+static int batch(const char *filename, const struct si5351_optimize_options *options,
+                 const struct cli_options *cli);
+static int table_generate(const char *filename, int source, char **args,
+                          const struct si5351_optimize_options *options);
+static int table_lookup(const char *filename, int nfreqs, char **freqs);
+static const void *table_map(const char *filename, size_t *size);
+static int serve(const char *socket_path, const char *lookup_file,
+                 const struct si5351_optimize_options *options,
+                 const struct cli_options *cli);
+static int hops(const char *filename, enum si5351_hop_mode mode,
+                const struct si5351_optimize_options *options,
+                const struct cli_options *cli);
+static int near(double xtal, double target, const struct si5351_reverse_options *reverse,
+                int count, const struct cli_options *cli);
+static int quadrature(const struct si5351_plan_request *request, const struct cli_options *cli);
 
 int main(int argc, char **argv) {
-    double xtal;
-    double clks[MAX_CLOCKS];
+    struct si5351_plan_request request;
+    struct si5351_optimize_options options;
+    int batch_mode = 0;
+    int optimize_mode = 0;
+    struct cli_options cli = {.jobs = 1, .format = OUTPUT_TEXT};
+    const char *table_file = NULL;
+    int table_source = 0;
+    const char *lookup_file = NULL;
+    int serve_mode = 0;
+    const char *socket_path = NULL;
+    int hop_mode = -1;
+    int near_mode = 0;
+    int quadrature_mode = 0;
+    struct si5351_reverse_options reverse;
 
-    if (argc > MAX_CLOCKS + 2) {
-        fprintf(stderr, "Too many arguments - maximum number of clocks is: %d\n", MAX_CLOCKS);
+    si5351_optimize_defaults(&options);
+    si5351_reverse_defaults(&reverse);
+
+    static const struct option long_options[] = {
+        {"batch", no_argument, NULL, 'b'},
+        {"optimize", no_argument, NULL, 'O'},
+        {"top-k", required_argument, NULL, 'k'},
+        {"single-pll", no_argument, NULL, '1'},
+        {"cache", required_argument, NULL, 'c'},
+        {"registers", no_argument, NULL, 'r'},
+        {"incremental", no_argument, NULL, 'i'},
+        {"jobs", required_argument, NULL, 'j'},
+        {"format", required_argument, NULL, 'f'},
+        {"best", required_argument, NULL, 'B'},
+        {"first", optional_argument, NULL, 'X'},
+        {"stats", no_argument, NULL, 'S'},
+        {"table", required_argument, NULL, 'T'},
+        {"table-source", required_argument, NULL, 'A'},
+        {"lookup", required_argument, NULL, 'L'},
+        {"serve", optional_argument, NULL, 'V'},
+        {"hops", optional_argument, NULL, 'H'},
+        {"near", optional_argument, NULL, 'N'},
+        {"quadrature", no_argument, NULL, 'Q'},
+        {"max-ppb", required_argument, NULL, 'p'},
+        {"fractional-penalty", required_argument, NULL, 'F'},
+        {"odd-penalty", required_argument, NULL, 'D'},
+        {"xtal-ppb", required_argument, NULL, 'P'},
+        {"xtal-measured", required_argument, NULL, 'M'},
+        {"temp-table", required_argument, NULL, 'E'},
+        {"temp", required_argument, NULL, 't'},
+        {"recalibrate", required_argument, NULL, 'R'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "bOk:rj:", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'b':
+            batch_mode = 1;
+            break;
+        case 'O':
+            optimize_mode = 1;
+            break;
+        case 'k':
+            options.top_k = atoi(optarg);
+            break;
+        case '1':
+            options.plls = 1;
+            break;
+        case 'c':
+            cli.cache_size = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            cli.registers = 1;
+            break;
+        case 'i':
+            cli.incremental = 1;
+            break;
+        case 'j':
+            cli.jobs = atoi(optarg);
+            break;
+        case 'S':
+            cli.stats = 1;
+            break;
+        case 'X':
+            cli.first = 1;
+            cli.first_ppb = optarg != NULL ? atof(optarg) : 0;
+            break;
+        case 'B':
+            cli.best = atoi(optarg);
+            if (cli.best < 1) {
+                fprintf(stderr, "invalid best: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'f':
+            cli.format = output_format(optarg);
+            if (cli.format < 0) {
+                fprintf(stderr, "invalid format: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'T':
+            table_file = optarg;
+            table_source = 0;
+            break;
+        case 'A':
+            table_file = optarg;
+            table_source = 1;
+            break;
+        case 'L':
+            lookup_file = optarg;
+            break;
+        case 'V':
+            serve_mode = 1;
+            socket_path = optarg;
+            break;
+        case 'H':
+            if (optarg == NULL || strcmp(optarg, "alternate") == 0) {
+                hop_mode = SI5351_HOP_ALTERNATE;
+            } else if (strcmp(optarg, "retune") == 0) {
+                hop_mode = SI5351_HOP_RETUNE;
+            } else {
+                fprintf(stderr, "invalid hop mode: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'N':
+            near_mode = 1;
+            if (optarg != NULL &&
+                sscanf(optarg, "%lf,%u,%u", &reverse.window, &reverse.max_feedback_denominator,
+                       &reverse.max_output_denominator) < 1) {
+                fprintf(stderr, "invalid window: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'Q':
+            quadrature_mode = 1;
+            break;
+        case 'P':
+            cli.calibration.ppb = atof(optarg);
+            break;
+        case 'M':
+            cli.xtal_measured = atof(optarg);
+            break;
+        case 'E':
+            if (read_temp_table(optarg, &cli.calibration) < 0)
+                return EXIT_FAILURE;
+            break;
+        case 't':
+            cli.temp = atof(optarg);
+            break;
+        case 'R':
+            cli.recalibrate = 1;
+            cli.recalibrate_ppb = atof(optarg);
+            break;
+        case 'p':
+            options.max_ppb = atof(optarg);
+            break;
+        case 'F':
+            options.fractional_penalty = atof(optarg);
+            break;
+        case 'D':
+            options.odd_integer_penalty = atof(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (options.top_k < 1) {
+        fprintf(stderr, "invalid top-k: %d\n", options.top_k);
         return EXIT_FAILURE;
     }
-    sscanf(argv[1], "%lf", &xtal);
-    for (int i = 2; i < argc; i++) {
-        sscanf(argv[i], "%lf", &clks[i-2]);
+    if (cli.jobs < 1 || (cli.jobs > 1 && cli.incremental)) {
+        fprintf(stderr, "invalid jobs: %d%s\n", cli.jobs, cli.incremental ? " (--incremental is sequential)" : "");
+        return EXIT_FAILURE;
     }
-    int nclks = argc - 2;
-
-    /* make sure xtal (CLKIN) is in the allowed 10-100MHz range */
-    if (xtal < SI5351_MIN_CLKIN_FREQ || xtal > SI5351_MAX_CLKIN_FREQ) {
-        fprintf(stderr, "XTAL reference (CKLIN) is out of range");
+    if (cli.stats) {
+        if (!si5351_stats_enabled())
+            fprintf(stderr, "--stats: counters not compiled in (build with CPPFLAGS=-DSI5351_STATS)\n");
+        else
+            atexit(print_stats);
+    }
+    if (cli.incremental && cli.format != OUTPUT_TEXT) {
+        fprintf(stderr, "--incremental only supports --format=text\n");
         return EXIT_FAILURE;
     }
+    argc -= optind - 1;
+    argv += optind - 1;
 
-    /* bring xtal (CLKIN) within the 10-40MHz range using CLKIN_DIV */
-    double xtal_orig = xtal;
-    uint8_t clkin_div = 0;
-    while (xtal > 40e6 && clkin_div <= 3) {
-        xtal /= 2.0;
-        clkin_div += 1;
+    if (serve_mode) {
+        if (argc != 1) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        return serve(socket_path, lookup_file, &options, &cli);
     }
-    if (clkin_div > 0) {
-        fprintf(stdout, "--> CLKIN_DIV=%d\n", clkin_div);
-        fprintf(stdout, "\n");
+    if (hop_mode >= 0) {
+        if (argc > 2) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        return hops(argc == 2 ? argv[1] : "-", hop_mode, &options, &cli);
+    }
+    if (near_mode) {
+        if (argc != 3) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        return near(atof(argv[1]), atof(argv[2]), &reverse, options.top_k, &cli);
+    }
+    if (table_file != NULL) {
+        if (argc != 5) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        return table_generate(table_file, table_source, argv + 1, &options);
+    }
+    if (lookup_file != NULL)
+        return table_lookup(lookup_file, argc - 1, argv + 1);
+    if (batch_mode) {
+        if (argc > 2) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        return batch(argc == 2 ? argv[1] : "-", &options, &cli);
     }
-    int xtal_div = 1 << clkin_div;
+    if (argc < 3) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (argc > SI5351_MAX_CLOCKS + 2) {
+        fprintf(stderr, "Too many arguments - maximum number of clocks is: %d\n", SI5351_MAX_CLOCKS);
+        return EXIT_FAILURE;
+    }
+    sscanf(argv[1], "%lf", &request.xtal);
+    for (int i = 2; i < argc; i++) {
+        sscanf(argv[i], "%lf", &request.clks[i-2]);
+    }
+    request.nclks = argc - 2;
+    if (cli.recalibrate) {
+        struct si5351_calibration calibration = cli.calibration;
+        calibration.ppb = cli.recalibrate_ppb;
+        cli.recalibrate_xtal = si5351_calibrated_xtal(&calibration, request.xtal, cli.temp);
+    }
+    calibrate_request(&cli, &request);
 
-    /* if the requested clock is below 1MHz, use an R divider */
-    double r_clk0 = clks[0];
-    uint8_t rdiv = 0;
-    while (r_clk0 < 1e6 && rdiv <= 7) {
-        r_clk0 *= 2.0;
-        rdiv += 1;
+    if (quadrature_mode) {
+        if (request.nclks != 1) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        return quadrature(&request, &cli);
     }
-    if (r_clk0 < 1e6) {
-        fprintf(stderr, "requested clock is too low: %'.0lf\n", clks[0]);
+    if (optimize_mode)
+        return optimize(&request, &options, &cli);
+    if (cli.format != OUTPUT_TEXT)
+        return candidates(&request, &cli);
+
+    struct si5351_setup setup = {0};
+    int status = si5351_setup(&setup, request.xtal, request.clks[0]);
+    if (status == SI5351_ERR_XTAL_RANGE) {
+        fprintf(stderr, "XTAL reference (CKLIN) is out of range");
+        return EXIT_FAILURE;
+    }
+    if (setup.clkin_div > 0) {
+        fprintf(stdout, "--> CLKIN_DIV=%d\n", setup.clkin_div);
+        fprintf(stdout, "\n");
+    }
+    if (status == SI5351_ERR_CLOCK_LOW) {
+        fprintf(stderr, "requested clock is too low: %'.0lf\n", request.clks[0]);
         return EXIT_FAILURE;
     }
 
@@ -73,213 +354,1057 @@ int main(int argc, char **argv) {
     fprintf(stdout, "first scenario - N-frac for feedback MS and even integer for output MS\n");
     fprintf(stdout, "\n");
 
-    /* choose an even integer for the output MS */
-    uint32_t output_ms = ((uint32_t)(SI5351_MAX_VCO_FREQ / r_clk0));
-    output_ms -= output_ms % 2;
-    if (output_ms < 4 || output_ms > 900) {
-        fprintf(stderr, "invalid output MS: %d (clock=%'.0lf)\n", output_ms, clks[0]);
+    status = list_scenario(1, &setup, &request, &cli, print_candidate, &setup);
+    if (status == SI5351_ERR_OUTPUT_MS) {
+        fprintf(stderr, "invalid output MS: %d (clock=%'.0lf)\n", setup.output_ms_max, request.clks[0]);
         return EXIT_FAILURE;
     }
 
-    /* try different values for f_VCO */
-    while (1) {
-        double f_vco = r_clk0 * output_ms;
-        if (output_ms < 4 || f_vco < SI5351_MIN_VCO_FREQ)
-            break;
+    fprintf(stdout, "\n");
 
-        /* feedback MS */
-        double feedback_ms = f_vco / xtal;
+    /* second scenario - even integer for feedback MS and N-frac for output MS */
+    fprintf(stdout, "second scenario - even integer for feedback MS and N-frac for output MS\n");
+    fprintf(stdout, "\n");
 
-        if (feedback_ms < 15 || feedback_ms > 90) {
-            fprintf(stderr, "invalid feedback MS: %'.0lf (xtal=%'.0lf/%d, output MS=%d, f_VCO=%'.0lf)\n", feedback_ms, xtal_orig, xtal_div, output_ms, f_vco);
-            fprintf(stderr, "\n");
-            output_ms -= 2;
-            continue;
+    status = list_scenario(2, &setup, &request, &cli, print_candidate, &setup);
+    if (status == SI5351_ERR_FEEDBACK_MS) {
+        if (setup.feedback_ms_max < 16) {
+            fprintf(stderr, "invalid feedback MS: %d (xtal=%'.0lf/%d, f_VCO=%'.0lf)\n", setup.feedback_ms_max, setup.xtal_orig, 1 << setup.clkin_div, setup.feedback_ms_max * setup.xtal);
+        } else {
+            fprintf(stderr, "invalid feedback MS: %d (xtal=%'.0lf/%d)\n", setup.feedback_ms_max, setup.xtal_orig, 1 << setup.clkin_div);
         }
+        return EXIT_FAILURE;
+    }
 
-        /* find a good rational approximation for feedback_ms */
-        uint32_t a;
-        uint32_t b;
-        uint32_t c;
-        rational_approximation(feedback_ms, SI5351_MAX_DENOMINATOR, &a, &b, &c);
-
-        char *is_integer = "";
-        if (b == 0) {
-            is_integer = a % 2 ? "   -> integer" : "   -> even integer";
-        } 
-        double actual_ratio = a + (double)b / (double)c;
-        double actual_pll_freq = xtal * actual_ratio;
-        fprintf(stdout, "actual PLL frequency: %'.0lf/%d * (%d + %d / %d) = %'.0lf%s\n", xtal_orig, xtal_div, a, b, c, actual_pll_freq, is_integer);
-
-        double actual_clk0 = actual_pll_freq / output_ms / (1 << rdiv);
-        fprintf(stdout, "actual clock 0: %'.0lf / %d = %'.0lf\n", actual_pll_freq, output_ms * (1 << rdiv), actual_clk0);
-        double clk_diff = actual_clk0 - clks[0];
-        if (clk_diff <= -CLOCK_TOLERANCE || clk_diff >= CLOCK_TOLERANCE) {
-            fprintf(stdout, "*** clock 0 difference: %'.0lg\n", clk_diff);
-        }
+    return EXIT_SUCCESS;
+}
 
-        /* additional clocks */
-        for (int nclk = 1; nclk < nclks; nclk++) {
-            double clk_output_ms = actual_pll_freq / clks[nclk];
-            /* find a good rational approximation for feedback_ms */
-            uint32_t a;
-            uint32_t b;
-            uint32_t c;
-            rational_approximation(clk_output_ms, SI5351_MAX_DENOMINATOR, &a, &b, &c);
-
-            double clk_actual_ratio = a + (double)b / (double)c;
-            if (clk_actual_ratio < 4 || clk_actual_ratio > 900) {
-                continue;
-            }
 
-            char *is_integer = "";
-            if (b == 0) {
-                is_integer = a % 2 ? "   -> integer" : "   -> even integer";
-            }
-            double actual_clk = actual_pll_freq / clk_actual_ratio;
-            fprintf(stdout, "actual clock %d: %'.0lf / (%d + %d / %d) = %'.0lf%s\n", nclk, actual_pll_freq, a, b, c, actual_clk, is_integer);
-            double clk_diff = actual_clk - clks[nclk];
-            if (clk_diff <= -CLOCK_TOLERANCE || clk_diff >= CLOCK_TOLERANCE) {
-                fprintf(stdout, "*** clock %d difference: %'.0lg\n", nclk, clk_diff);
-            }
+static void usage(const char *progname)
+{
+    fprintf(stderr, "usage: %s [--best=K] [--format=FORMAT] xtal clk0 [clk1 ... clk7]\n", progname);
+    fprintf(stderr, "       %s -O [-r] [--format=FORMAT] [-k K] [--single-pll] [--max-ppb=PPB] [--fractional-penalty=PPB] [--odd-penalty=PPB] xtal clk0 [clk1 ... clk7]\n", progname);
+    fprintf(stderr, "       %s -b [-r | --incremental] [--format=FORMAT] [-j N] [--first[=PPB]] [--cache=ENTRIES] [--max-ppb=PPB] [file]\n", progname);
+    fprintf(stderr, "       %s --table=FILE xtal start step count\n", progname);
+    fprintf(stderr, "       %s --table-source=FILE.c xtal start step count\n", progname);
+    fprintf(stderr, "       %s --lookup=FILE freq...\n", progname);
+    fprintf(stderr, "       %s --quadrature [-r] [--format=FORMAT] xtal clk\n", progname);
+    fprintf(stderr, "       %s --near[=WINDOW[,FB_DEN[,MS_DEN]]] [-k K] [--format=FORMAT] xtal target\n", progname);
+    fprintf(stderr, "       %s --hops[=alternate|retune] [--cache=ENTRIES] [--max-ppb=PPB] [optimizer options] [file]\n", progname);
+    fprintf(stderr, "       %s --serve[=SOCKET] [--incremental] [--cache=ENTRIES] [--lookup=FILE] [optimizer options]\n", progname);
+    fprintf(stderr, "FORMAT is text (default), csv, jsonl or bin\n");
+    fprintf(stderr, "--xtal-ppb=PPB or --xtal-measured=HZ, --temp-table=FILE and --temp=C correct the xtal of every request;\n");
+    fprintf(stderr, "-O --recalibrate=PPB also re-plans the plans for a new --xtal-ppb keeping their dividers\n");
+    fprintf(stderr, "--stats prints the solver counters on exit\n");
+}
+
+/* "temp ppb" lines ('#' comments), increasing temperatures */
+static int read_temp_table(const char *filename, struct si5351_calibration *calibration)
+{
+    FILE *in = fopen(filename, "r");
+    if (in == NULL) {
+        perror(filename);
+        return -1;
+    }
+    char line[256];
+    int lineno = 0;
+    calibration->npoints = 0;
+    while (fgets(line, sizeof(line), in) != NULL) {
+        lineno++;
+        char *p = line;
+        while (*p == ' ' || *p == '\t')
+            p++;
+        if (*p == '#' || *p == '\n' || *p == '\0')
+            continue;
+        int n = calibration->npoints;
+        if (n == SI5351_MAX_TEMP_POINTS ||
+            sscanf(p, "%lf %lf", &calibration->temp[n], &calibration->temp_ppb[n]) != 2 ||
+            (n > 0 && calibration->temp[n] <= calibration->temp[n - 1])) {
+            fprintf(stderr, "%s:%d: expected temp ppb (increasing temp, at most %d lines)\n", filename, lineno, SI5351_MAX_TEMP_POINTS);
+            fclose(in);
+            return -1;
         }
+        calibration->npoints++;
+    }
+    fclose(in);
+    return 0;
+}
 
-        fprintf(stdout, "\n");
-        output_ms -= 2;
+/* a buffer per thread for the cache entries and the optimizer scratch
+ * memory of any request, so planning does not allocate
+ */
+static int scratch_init(struct si5351_arena *arena, void **buffer, uint32_t cache_size,
+                        const struct si5351_optimize_options *options)
+{
+    size_t size = si5351_optimize_scratch_size(SI5351_MAX_CLOCKS, options);
+    if (cache_size > 0)
+        size += si5351_cache_arena_size(cache_size);
+    *buffer = malloc(size);
+    if (*buffer == NULL)
+        return SI5351_ERR_NOMEM;
+    si5351_arena_init(arena, *buffer, size);
+    return SI5351_OK;
+}
+
+/* plan for the corrected xtal */
+static void calibrate_request(const struct cli_options *cli, struct si5351_plan_request *request)
+{
+    struct si5351_calibration calibration = cli->calibration;
+    if (cli->xtal_measured != 0)
+        calibration.ppb = (cli->xtal_measured / request->xtal - 1) * 1e9;
+    if (calibration.ppb != 0 || calibration.npoints > 0)
+        request->xtal = si5351_calibrated_xtal(&calibration, request->xtal, cli->temp);
+}
+
+
+static void print_stats(void)
+{
+    struct si5351_stats stats = worker_stats;
+    struct si5351_stats main_stats;
+    si5351_stats_get(&main_stats);
+    si5351_stats_add(&stats, &main_stats);
+
+    fflush(stdout);
+    fprintf(stderr, "approximations: %llu\n", (unsigned long long)stats.approximations);
+    fprintf(stderr, "exact approximations: %llu\n", (unsigned long long)stats.exact_approximations);
+    fprintf(stderr, "continued fraction terms: %llu\n", (unsigned long long)stats.cf_terms);
+    fprintf(stderr, "semiconvergents tested: %llu\n", (unsigned long long)stats.semiconvergents);
+    fprintf(stderr, "scenario candidates: %llu\n", (unsigned long long)stats.candidates);
+    fprintf(stderr, "rejected by prefilter: %llu\n", (unsigned long long)stats.rejected_prefilter);
+    fprintf(stderr, "rejected feedback MS: %llu\n", (unsigned long long)stats.rejected_feedback_ms);
+    fprintf(stderr, "rejected output MS: %llu\n", (unsigned long long)stats.rejected_output_ms);
+    fprintf(stderr, "optimizer evaluations: %llu\n", (unsigned long long)stats.optimizer_evaluations);
+    fprintf(stderr, "optimizer pruned: %llu\n", (unsigned long long)stats.optimizer_pruned);
+}
+
+
+static const char *integer_tag(const struct si5351_ms *ms)
+{
+    if (ms->b != 0)
+        return "";
+    return ms->a % 2 ? "   -> integer" : "   -> even integer";
+}
+
+static const char *ms_class_name(uint8_t class)
+{
+    switch (class) {
+    case SI5351_MS_EVEN_INTEGER:
+        return "even integer";
+    case SI5351_MS_ODD_INTEGER:
+        return "odd integer";
+    default:
+        return "fractional";
     }
+}
 
-    fprintf(stdout, "\n");
+static void print_candidate(const struct si5351_plan_result *candidate, void *arg)
+{
+    const struct si5351_setup *setup = arg;
+    const struct si5351_ms *fb = &candidate->feedback[SI5351_PLLA];
+    const struct si5351_ms *ms0 = &candidate->output[0];
+    double actual_pll_freq = candidate->pll_freq[SI5351_PLLA];
+    int xtal_div = 1 << setup->clkin_div;
+    int r = 1 << setup->rdiv;
+
+    if (candidate->status == SI5351_ERR_FEEDBACK_MS) {
+        double feedback_ms = candidate->pll_freq[SI5351_PLLA] / setup->xtal;
+        fprintf(stderr, "invalid feedback MS: %'.0lf (xtal=%'.0lf/%d, output MS=%d, f_VCO=%'.0lf)\n", feedback_ms, setup->xtal_orig, xtal_div, ms0->a, candidate->pll_freq[SI5351_PLLA]);
+        fprintf(stderr, "\n");
+        return;
+    }
+    if (candidate->status == SI5351_ERR_OUTPUT_MS) {
+        fprintf(stderr, "invalid output MS: %d + %d / %d (clock=%'.0lf, f_VCO=%'.0lf)\n", ms0->a, ms0->b, ms0->c, candidate->clks[0], actual_pll_freq);
+        fprintf(stderr, "\n");
+        return;
+    }
+
+    if (candidate->scenario == 1) {
+        fprintf(stdout, "actual PLL frequency: %'.0lf/%d * (%d + %d / %d) = %'.0lf%s\n", setup->xtal_orig, xtal_div, fb->a, fb->b, fb->c, actual_pll_freq, integer_tag(fb));
+        fprintf(stdout, "actual clock 0: %'.0lf / %d = %'.0lf\n", actual_pll_freq, ms0->a * r, candidate->actual[0]);
+    } else {
+        fprintf(stdout, "actual PLL frequency: %'.0lf/%d * %d\n", setup->xtal_orig, xtal_div, fb->a);
+        fprintf(stdout, "actual PLL frequency: %'.0lf\n", actual_pll_freq);
+        fprintf(stdout, "actual clock 0: %'.0lf / (%d + %d / %d) / %d = %'.0lf%s\n", actual_pll_freq, ms0->a, ms0->b, ms0->c, r, candidate->actual[0], integer_tag(ms0));
+    }
+    double clk_diff = candidate->clk_diff[0];
+    if (clk_diff <= -CLOCK_TOLERANCE || clk_diff >= CLOCK_TOLERANCE) {
+        fprintf(stdout, "*** clock 0 difference: %'.0lg\n", clk_diff);
+    }
+
+    /* additional clocks */
+    for (int nclk = 1; nclk < candidate->nclks; nclk++) {
+        if (!candidate->valid[nclk])
+            continue;
+        const struct si5351_ms *ms = &candidate->output[nclk];
+        fprintf(stdout, "actual clock %d: %'.0lf / (%d + %d / %d) = %'.0lf%s\n", nclk, actual_pll_freq, ms->a, ms->b, ms->c, candidate->actual[nclk], integer_tag(ms));
+        double clk_diff = candidate->clk_diff[nclk];
+        if (clk_diff <= -CLOCK_TOLERANCE || clk_diff >= CLOCK_TOLERANCE) {
+            fprintf(stdout, "*** clock %d difference: %'.0lg\n", nclk, clk_diff);
+        }
+    }
 
-    /* second scenario - even integer for feedback MS and N-frac for output MS */
-    fprintf(stdout, "second scenario - even integer for feedback MS and N-frac for output MS\n");
     fprintf(stdout, "\n");
+}
 
-    /* choose an even integer for the feedback MS */
-    uint32_t feedback_ms = ((uint32_t)(SI5351_MAX_VCO_FREQ / xtal));
-    feedback_ms -= feedback_ms % 2;
-    if (feedback_ms < 16) {
-        fprintf(stderr, "invalid feedback MS: %d (xtal=%'.0lf/%d, output MS=%d, f_VCO=%'.0lf)\n", feedback_ms, xtal_orig, xtal_div, clkin_div, output_ms, feedback_ms * xtal);
-        return EXIT_FAILURE;
+
+static void print_registers(const struct si5351_plan_result *plan)
+{
+    struct si5351_ms_params params;
+
+    for (int pll = SI5351_PLLA; pll <= SI5351_PLLB; pll++) {
+        if (plan->pll_freq[pll] == 0)
+            continue;
+        si5351_encode_ms(&plan->feedback[pll], &params);
+        fprintf(stdout, "MSN%c: P1=%u P2=%u P3=%u\n", 'A' + pll, params.p1, params.p2, params.p3);
     }
-    if (feedback_ms > 90) {
-        feedback_ms = 90;
-        if (xtal * feedback_ms < SI5351_MIN_VCO_FREQ) {
-            fprintf(stderr, "invalid feedback MS: %d (xtal=%'.0lf/%d)\n", feedback_ms, xtal_orig, xtal_div);
-            return EXIT_FAILURE;
+    for (int nclk = 0; nclk < plan->nclks; nclk++) {
+        if (nclk >= SI5351_FIRST_INTEGER_ONLY_CLOCK) {
+            fprintf(stdout, "MS%d: P1=%u R%d_DIV=%d\n", nclk, plan->output[nclk].a, nclk, plan->rdiv[nclk]);
+            continue;
         }
+        si5351_encode_ms(&plan->output[nclk], &params);
+        fprintf(stdout, "MS%d: P1=%u P2=%u P3=%u R%d_DIV=%d\n", nclk, params.p1, params.p2, params.p3, nclk, plan->rdiv[nclk]);
     }
+    fprintf(stdout, "registers %d-%d: ", SI5351_REG_IMAGE_FIRST, SI5351_REG_IMAGE_FIRST + SI5351_REG_IMAGE_SIZE - 1);
+    output_image(stdout, plan);
+    fprintf(stdout, "\n");
+}
 
-    /* try different values for f_VCO */
-    while (1) {
-        double f_vco = xtal * feedback_ms;
-        if (feedback_ms < 16 || f_vco < SI5351_MIN_VCO_FREQ)
-            break;
 
-        /* output MS */
-        double output_ms = f_vco / r_clk0;
-        /* find a good rational approximation for output_ms */
-        uint32_t a;
-        uint32_t b;
-        uint32_t c;
-        rational_approximation(output_ms, SI5351_MAX_DENOMINATOR, &a, &b, &c);
+/* every candidate of a scenario, or only the best cli->best ones (best
+ * first), for fn
+ */
+static int list_scenario(int scenario, const struct si5351_setup *setup,
+                         const struct si5351_plan_request *request,
+                         const struct cli_options *cli,
+                         si5351_candidate_fn fn, void *arg)
+{
+    int (*plan_scenario)(const struct si5351_setup *, const struct si5351_plan_request *, si5351_candidate_fn, void *) =
+        scenario == 1 ? si5351_plan_scenario1 : si5351_plan_scenario2;
+    if (cli->best == 0)
+        return plan_scenario(setup, request, fn, arg);
 
-        fprintf(stdout, "actual PLL frequency: %'.0lf/%d * %d\n", xtal_orig, xtal_div, feedback_ms);
+    struct si5351_best best = {0};
+    best.entries = calloc(cli->best, sizeof(*best.entries));
+    if (best.entries == NULL) {
+        perror("calloc");
+        return SI5351_ERR_NOMEM;
+    }
+    best.k = cli->best;
+    int status = plan_scenario(setup, request, si5351_best_candidate, &best);
+    int n = si5351_best_sort(&best);
+    for (int i = 0; i < n; i++)
+        fn(&best.entries[i].plan, arg);
+    free(best.entries);
+    return status;
+}
 
-        double actual_pll_freq = xtal * feedback_ms;
-        fprintf(stdout, "actual PLL frequency: %'.0lf\n", actual_pll_freq);
 
-        char *is_integer = "";
-        if (b == 0) {
-            is_integer = a % 2 ? "   -> integer" : "   -> even integer";
-        } 
-        double actual_ratio = a + (double)b / (double)c;
-        double actual_clk0 = actual_pll_freq / actual_ratio / (1 << rdiv);
-        fprintf(stdout, "actual clock 0: %'.0lf / (%d + %d / %d) / %d = %'.0lf%s\n", actual_pll_freq, a, b, c, 1 << rdiv, actual_clk0, is_integer);
-        double clk_diff = actual_clk0 - clks[0];
+/* every candidate of both scenarios as machine readable records */
+struct candidates_arg {
+    const struct si5351_plan_request *request;
+    const struct cli_options *cli;
+};
+
+static void output_candidate(const struct si5351_plan_result *candidate, void *arg)
+{
+    const struct candidates_arg *candidates = arg;
+    /* scenario candidates come without their quality */
+    struct si5351_plan_result plan = *candidate;
+    si5351_plan_quality(&plan, &plan.quality);
+    output_record(stdout, candidates->cli->format, candidates->cli->registers, candidates->request, candidate->status, &plan);
+}
+
+static int candidates(const struct si5351_plan_request *request,
+                      const struct cli_options *cli)
+{
+    static char outbuf[1 << 16];
+    setvbuf(stdout, outbuf, _IOFBF, sizeof(outbuf));
+    output_header(stdout, cli->format, cli->registers);
+
+    struct si5351_setup setup = {0};
+    int status = si5351_setup(&setup, request->xtal, request->clks[0]);
+    if (status != SI5351_OK) {
+        output_record(stdout, cli->format, cli->registers, request, status, NULL);
+        return EXIT_FAILURE;
+    }
+    struct candidates_arg arg = {request, cli};
+    int status1 = list_scenario(1, &setup, request, cli, output_candidate, &arg);
+    if (status1 != SI5351_OK)
+        output_record(stdout, cli->format, cli->registers, request, status1, NULL);
+    int status2 = list_scenario(2, &setup, request, cli, output_candidate, &arg);
+    if (status2 != SI5351_OK)
+        output_record(stdout, cli->format, cli->registers, request, status2, NULL);
+    return status1 == SI5351_OK && status2 == SI5351_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/* optimizer - best (or top-K) plans across all VCO frequencies */
+static void print_plan(double xtal, const struct si5351_plan_result *plan,
+                       const struct cli_options *cli)
+{
+    const struct si5351_plan_quality *quality = &plan->quality;
+    fprintf(stdout, "cost=%.6g max clock difference=%'.0lg\n", plan->cost, plan->max_clk_diff);
+    fprintf(stdout, "quality: %d fractional, %d odd integer MultiSynths, max denominator %u, VCO margin %'.0lf\n", quality->nfractional, quality->nodd, quality->max_denominator, quality->vco_margin);
+    for (int pll = SI5351_PLLA; pll <= SI5351_PLLB; pll++) {
+        const struct si5351_ms *fb = &plan->feedback[pll];
+        if (plan->pll_freq[pll] == 0)
+            continue;
+        fprintf(stdout, "PLL%c frequency: %'.0lf/%d * (%d + %d / %d) = %'.0lf%s\n", 'A' + pll, xtal, 1 << plan->clkin_div, fb->a, fb->b, fb->c, plan->pll_freq[pll], integer_tag(fb));
+        fprintf(stdout, "PLL%c clocks:", 'A' + pll);
+        for (int nclk = 0; nclk < plan->nclks; nclk++) {
+            if (plan->pll[nclk] == pll)
+                fprintf(stdout, " %d", nclk);
+        }
+        fprintf(stdout, "\n");
+    }
+    for (int nclk = 0; nclk < plan->nclks; nclk++) {
+        const struct si5351_ms *ms = &plan->output[nclk];
+        fprintf(stdout, "actual clock %d: PLL%c / (%d + %d / %d) / %d = %'.0lf%s\n", nclk, 'A' + plan->pll[nclk], ms->a, ms->b, ms->c, 1 << plan->rdiv[nclk], plan->actual[nclk], integer_tag(ms));
+        double clk_diff = plan->clk_diff[nclk];
         if (clk_diff <= -CLOCK_TOLERANCE || clk_diff >= CLOCK_TOLERANCE) {
-            fprintf(stdout, "*** clock 0 difference: %'.0lg\n", clk_diff);
+            fprintf(stdout, "*** clock %d difference: %'.0lg\n", nclk, clk_diff);
         }
+    }
+    if (cli->registers)
+        print_registers(plan);
+    fprintf(stdout, "\n");
+}
+
+static int optimize(const struct si5351_plan_request *request,
+                    const struct si5351_optimize_options *options,
+                    const struct cli_options *cli)
+{
+    struct si5351_setup setup = {0};
+    struct si5351_plan_result *plans = calloc(options->top_k, sizeof(*plans));
+    if (plans == NULL) {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
 
-        /* additional clocks */
-        for (int nclk = 1; nclk < nclks; nclk++) {
-            double clk_output_ms = actual_pll_freq / clks[nclk];
-            /* find a good rational approximation for feedback_ms */
-            uint32_t a;
-            uint32_t b;
-            uint32_t c;
-            rational_approximation(clk_output_ms, SI5351_MAX_DENOMINATOR, &a, &b, &c);
-
-            double clk_actual_ratio = a + (double)b / (double)c;
-            if (clk_actual_ratio < 4 || clk_actual_ratio > 900) {
+    int nplans = si5351_optimize(&setup, request, options, plans);
+    if (nplans < 0) {
+        fprintf(stderr, "no plan: %s\n", si5351_strerror(nplans));
+        free(plans);
+        return EXIT_FAILURE;
+    }
+    if (cli->format != OUTPUT_TEXT) {
+        output_header(stdout, cli->format, cli->registers);
+        struct si5351_plan_request recalibrated_request = *request;
+        recalibrated_request.xtal = cli->recalibrate_xtal;
+        for (int i = 0; i < nplans; i++) {
+            output_record(stdout, cli->format, cli->registers, request, SI5351_OK, &plans[i]);
+            struct si5351_plan_result recalibrated;
+            if (!cli->recalibrate)
                 continue;
-            }
+            int status = si5351_recalibrate(&plans[i], cli->recalibrate_xtal, &recalibrated);
+            output_record(stdout, cli->format, cli->registers, &recalibrated_request, status,
+                          status == SI5351_OK ? &recalibrated : NULL);
+        }
+        free(plans);
+        return EXIT_SUCCESS;
+    }
 
-            char *is_integer = "";
-            if (b == 0) {
-                is_integer = a % 2 ? "   -> integer" : "   -> even integer";
-            }
-            double actual_clk = actual_pll_freq / clk_actual_ratio;
-            fprintf(stdout, "actual clock %d: %'.0lf / (%d + %d / %d) = %'.0lf%s\n", nclk, actual_pll_freq, a, b, c, actual_clk, is_integer);
-            double clk_diff = actual_clk - clks[nclk];
-            if (clk_diff <= -CLOCK_TOLERANCE || clk_diff >= CLOCK_TOLERANCE) {
-                fprintf(stdout, "*** clock %d difference: %'.0lg\n", nclk, clk_diff);
-            }
+    for (int i = 0; i < nplans; i++) {
+        fprintf(stdout, "plan %d: ", i + 1);
+        print_plan(request->xtal, &plans[i], cli);
+        if (!cli->recalibrate)
+            continue;
+        struct si5351_plan_result recalibrated;
+        int status = si5351_recalibrate(&plans[i], cli->recalibrate_xtal, &recalibrated);
+        fprintf(stdout, "plan %d recalibrated to %g ppb: ", i + 1, cli->recalibrate_ppb);
+        if (status != SI5351_OK) {
+            fprintf(stdout, "%s\n\n", si5351_strerror(status));
+            continue;
         }
+        print_plan(cli->recalibrate_xtal, &recalibrated, cli);
+    }
 
-        fprintf(stdout, "\n");
-        feedback_ms -= 2;
+    free(plans);
+    return EXIT_SUCCESS;
+}
+
+
+/* clock 0 (I) and clock 1 (Q, 90 degrees behind) at request->clks[0] */
+static int quadrature(const struct si5351_plan_request *request, const struct cli_options *cli)
+{
+    struct si5351_setup setup = {0};
+    struct si5351_quadrature iq;
+    int status = si5351_plan_quadrature(&setup, request->xtal, request->clks[0], &iq);
+    if (status != SI5351_OK) {
+        fprintf(stderr, "no quadrature plan: %s\n", si5351_strerror(status));
+        return EXIT_FAILURE;
+    }
+    if (cli->format != OUTPUT_TEXT) {
+        const struct si5351_plan_request iq_request = {request->xtal, 2, {request->clks[0], request->clks[0]}};
+        output_header(stdout, cli->format, cli->registers);
+        output_record(stdout, cli->format, cli->registers, &iq_request, SI5351_OK, &iq.plan);
+        return EXIT_SUCCESS;
     }
 
+    fprintf(stdout, "quadrature: ");
+    print_plan(request->xtal, &iq.plan, cli);
+    fprintf(stdout, "CLK1_PHOFF: %u (clock 1 is 90 degrees behind clock 0)\n", iq.phoff);
+    if (cli->registers) {
+        struct si5351_reg_write writes[SI5351_QUADRATURE_WRITES];
+        int nwrites = si5351_quadrature_writes(&iq, writes);
+        fprintf(stdout, "then:");
+        for (int i = 0; i < nwrites; i++)
+            fprintf(stdout, " %d:%02x", writes[i].reg, writes[i].value);
+        fprintf(stdout, "\n");
+    }
     return EXIT_SUCCESS;
 }
 
+/* reverse query: the K frequencies nearest to target within the window
+ * that have a low denominator plan, one per line
+ */
+static int near(double xtal, double target, const struct si5351_reverse_options *reverse,
+                int count, const struct cli_options *cli)
+{
+    struct si5351_plan_result *plans = calloc(count, sizeof(*plans));
+    if (plans == NULL) {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
+
+    int nplans = si5351_reverse_query(xtal, target, reverse, count, plans);
+    if (nplans < 0) {
+        fprintf(stderr, "no plan: %s\n", si5351_strerror(nplans));
+        free(plans);
+        return EXIT_FAILURE;
+    }
+    struct si5351_plan_request request = {xtal, 1, {target}};
+    if (cli->format != OUTPUT_TEXT)
+        output_header(stdout, cli->format, cli->registers);
+    for (int i = 0; i < nplans; i++) {
+        const struct si5351_plan_result *plan = &plans[i];
+        const struct si5351_ms *fb = &plan->feedback[SI5351_PLLA];
+        const struct si5351_ms *ms = &plan->output[0];
+        if (cli->format != OUTPUT_TEXT) {
+            output_record(stdout, cli->format, cli->registers, &request, SI5351_OK, plan);
+            continue;
+        }
+        fprintf(stdout, "%'.3lf (%+.3lf): %'.0lf/%d * (%d + %d / %d) / (%d + %d / %d) / %d  %s feedback, %s output MS\n",
+                plan->actual[0], plan->clk_diff[0], xtal, 1 << plan->clkin_div, fb->a, fb->b, fb->c,
+                ms->a, ms->b, ms->c, 1 << plan->rdiv[0],
+                ms_class_name(plan->quality.feedback_class[SI5351_PLLA]),
+                ms_class_name(plan->quality.output_class[0]));
+        if (cli->registers)
+            print_registers(plan);
+    }
+    free(plans);
+    return EXIT_SUCCESS;
+}
 
-/* best rational approximation:
+/* batch mode
  *
- *     value ~= a + b/c     (where c <= max_denominator)
+ * reads one "xtal clk0 [clk1 ... clk7]" tuple per line (blank lines and
+ * lines starting with '#' are ignored) and writes one compact record per
+ * tuple with the best plan across both scenarios:
  *
- * References:
- * - https://en.wikipedia.org/wiki/Continued_fraction#Best_rational_approximations
+ *     xtal clk0 [clk1 ... clk7] scenario clkin_div rdiv f_pll fb_a fb_b fb_c
+ *         ms0_a ms0_b ms0_c [ms1_a ms1_b ms1_c ...] max_clk_diff [registers]
+ *
+ * or "xtal clk0 [clk1 ... clk7] error <reason>" when no plan exists.
+ * The setup (CLKIN_DIV and the R divider) is shared across tuples, and so
+ * are the rational approximations if cli->cache_size > 0. With
+ * cli->registers, the record ends with the register image in hex.
+ *
+ * With cli->incremental, every tuple is retuned from the previous plan
+ * (see si5351_retune()) and the record lists the register writes from the
+ * previous image (all zeros for the first tuple):
+ *
+ *     xtal clk0 [clk1 ... clk7] pll_reset nwrites [reg:value ...]
+ *
+ * With cli->first, the plan is the first one within cli->first_ppb (see
+ * si5351_plan_first()) rather than the best one.
+ *
+ * With cli->format other than OUTPUT_TEXT, every tuple is written as an
+ * output_record() of its best plan (or of the error) instead.
+ *
+ * With cli->jobs > 1, all the tuples are read first and split into chunks
+ * of BATCH_CHUNK_SIZE; cli->jobs worker threads, each with its own setup
+ * and cache, take the next chunk from a shared queue and plan it into a
+ * memory buffer. The buffers are then written in order, so the output is
+ * the same as with a single job.
  */
-static void rational_approximation(double value, uint32_t max_denominator,
-                                   uint32_t *a, uint32_t *b, uint32_t *c)
-{
-    const double epsilon = 1e-5;
-
-    double af;
-    double f0 = modf(value, &af);
-    *a = (uint32_t) af;
-    *b = 0;
-    *c = 1;
-    double f = f0;
-    double delta = f0;
-    /* we need to take into account that the fractional part has a_0 = 0 */
-    uint32_t h[] = {1, 0};
-    uint32_t k[] = {0, 1};
-    for(int i = 0; i < 100; ++i){
-        if(f <= epsilon){
+
+/* per thread planning state */
+struct batch_state {
+    const struct si5351_optimize_options *options;
+    const struct cli_options *cli;
+    struct si5351_setup setup;
+    struct si5351_cache cache;
+    struct si5351_arena arena;  /* the cache entries and optimizer scratch */
+    void *buffer;
+    struct si5351_plan_result previous;     /* cli->incremental */
+    int have_previous;
+    uint8_t image[2][SI5351_REG_IMAGE_SIZE];
+    int current;
+};
+
+/* tuples planned by a worker into a memory buffer */
+struct batch_chunk {
+    size_t first;
+    size_t count;
+    char *output;
+    size_t output_size;
+    int status;
+};
+
+/* work queue shared by the workers */
+struct batch_queue {
+    pthread_mutex_t lock;
+    const struct si5351_plan_request *requests;
+    struct batch_chunk *chunks;
+    size_t nchunks;
+    size_t next;
+};
+
+struct batch_worker_arg {
+    struct batch_state state;
+    struct batch_queue *queue;
+    struct si5351_stats stats;  /* of the worker thread */
+};
+
+static const size_t BATCH_CHUNK_SIZE = 1024;
+
+static int batch_state_init(struct batch_state *state,
+                            const struct si5351_optimize_options *options,
+                            const struct cli_options *cli)
+{
+    memset(state, 0, sizeof(*state));
+    state->options = options;
+    state->cli = cli;
+    if (scratch_init(&state->arena, &state->buffer, cli->cache_size, options) != SI5351_OK)
+        return SI5351_ERR_NOMEM;
+    state->setup.arena = &state->arena;
+    if (cli->cache_size > 0) {
+        si5351_cache_init_arena(&state->cache, &state->arena, cli->cache_size);
+        state->setup.cache = &state->cache;
+    }
+    return SI5351_OK;
+}
+
+static void batch_state_free(struct batch_state *state)
+{
+    free(state->buffer);
+}
+
+static int batch_plan(struct batch_state *state,
+                      const struct si5351_plan_request *request,
+                      struct si5351_plan_result *plan)
+{
+    if (state->cli->first)
+        return si5351_plan_first(&state->setup, request, state->cli->first_ppb, plan);
+    return si5351_plan(&state->setup, request, plan);
+}
+
+static void batch_record(FILE *out, struct batch_state *state,
+                         const struct si5351_plan_request *request)
+{
+    if (state->cli->format != OUTPUT_TEXT) {
+        struct si5351_plan_result plan;
+        int status = batch_plan(state, request, &plan);
+        output_record(out, state->cli->format, state->cli->registers, request, status, status == SI5351_OK ? &plan : NULL);
+        return;
+    }
+
+    fprintf(out, "%.0f", request->xtal);
+    for (int nclk = 0; nclk < request->nclks; nclk++)
+        fprintf(out, " %.0f", request->clks[nclk]);
+
+    if (state->cli->incremental) {
+        struct si5351_plan_result plan;
+        int pll_reset;
+        int status = si5351_retune(&state->setup, state->options, state->have_previous ? &state->previous : NULL, request, &plan, &pll_reset);
+        if (status != SI5351_OK) {
+            fprintf(out, " error %s\n", si5351_strerror(status));
+            return;
+        }
+        state->previous = plan;
+        state->have_previous = 1;
+
+        struct si5351_reg_write writes[SI5351_REG_IMAGE_SIZE];
+        uint8_t *old_image = state->image[state->current];
+        uint8_t *new_image = state->image[!state->current];
+        si5351_register_image(&plan, new_image);
+        int nwrites = si5351_register_delta(old_image, new_image, writes);
+        state->current = !state->current;
+        fprintf(out, " %d %d", pll_reset, nwrites);
+        for (int i = 0; i < nwrites; i++)
+            fprintf(out, " %d:%02x", writes[i].reg, writes[i].value);
+        fprintf(out, "\n");
+        return;
+    }
+
+    struct si5351_plan_result plan;
+    int status = batch_plan(state, request, &plan);
+    if (status != SI5351_OK) {
+        fprintf(out, " error %s\n", si5351_strerror(status));
+        return;
+    }
+
+    fprintf(out, " %d %d %d %.0f %u %u %u", plan.scenario, plan.clkin_div, plan.rdiv[0], plan.pll_freq[SI5351_PLLA], plan.feedback[SI5351_PLLA].a, plan.feedback[SI5351_PLLA].b, plan.feedback[SI5351_PLLA].c);
+    for (int nclk = 0; nclk < request->nclks; nclk++)
+        fprintf(out, " %u %u %u", plan.output[nclk].a, plan.output[nclk].b, plan.output[nclk].c);
+    fprintf(out, " %.3g", plan.max_clk_diff);
+    if (state->cli->registers) {
+        fprintf(out, " ");
+        output_image(out, &plan);
+    }
+    fprintf(out, "\n");
+}
+
+static void *batch_worker(void *arg)
+{
+    struct batch_worker_arg *worker = arg;
+    struct batch_queue *queue = worker->queue;
+    while (1) {
+        pthread_mutex_lock(&queue->lock);
+        size_t n = queue->next++;
+        pthread_mutex_unlock(&queue->lock);
+        if (n >= queue->nchunks)
             break;
+
+        struct batch_chunk *chunk = &queue->chunks[n];
+        FILE *out = open_memstream(&chunk->output, &chunk->output_size);
+        if (out == NULL) {
+            chunk->status = SI5351_ERR_NOMEM;
+            continue;
         }
-        double anf;
-        f = modf(1.0 / f,&anf);
-        uint32_t an = (uint32_t) anf;
-        for(uint32_t m = (an + 1) / 2; m <= an; ++m){
-            uint32_t hm = m * h[1] + h[0];
-            uint32_t km = m * k[1] + k[0];
-            if(km > max_denominator){
-                break;
+        for (size_t i = chunk->first; i < chunk->first + chunk->count; i++)
+            batch_record(out, &worker->state, &queue->requests[i]);
+        if (fclose(out) != 0)
+            chunk->status = SI5351_ERR_NOMEM;
+    }
+    si5351_stats_get(&worker->stats);
+    return NULL;
+}
+
+/* next tuple from in; returns 0 at end of file */
+static int batch_read(FILE *in, const char *filename, int *lineno,
+                      const struct cli_options *cli, struct si5351_plan_request *request)
+{
+    char line[256];
+    while (fgets(line, sizeof(line), in) != NULL) {
+        (*lineno)++;
+        char *p = line;
+        while (*p == ' ' || *p == '\t')
+            p++;
+        if (*p == '#' || *p == '\n' || *p == '\0')
+            continue;
+
+        if (!input_request(p, request)) {
+            fprintf(stderr, "%s:%d: expected xtal clk0 [clk1 ... clk7]\n", filename, *lineno);
+            continue;
+        }
+        calibrate_request(cli, request);
+        return 1;
+    }
+    return 0;
+}
+
+/* all the tuples from in into *requests (NULL if out of memory); returns
+ * their number
+ */
+static size_t batch_read_all(FILE *in, const char *filename, const struct cli_options *cli,
+                             struct si5351_plan_request **requests)
+{
+    size_t nrequests = 0;
+    size_t size = 0;
+    int lineno = 0;
+
+    *requests = NULL;
+    struct si5351_plan_request request;
+    while (batch_read(in, filename, &lineno, cli, &request)) {
+        if (nrequests == size) {
+            size = size == 0 ? 4096 : 2 * size;
+            struct si5351_plan_request *grown = realloc(*requests, size * sizeof(**requests));
+            if (grown == NULL) {
+                perror("realloc");
+                free(*requests);
+                *requests = NULL;
+                return 0;
             }
-            double d = fabs((double) hm / (double) km - f0);
-            if(d < delta){
-                delta = d;
-                *b = hm;
-                *c = km;
+            *requests = grown;
+        }
+        (*requests)[nrequests++] = request;
+    }
+    if (*requests == NULL)
+        *requests = malloc(sizeof(**requests));
+    return nrequests;
+}
+
+static void print_cache_stats(uint64_t hits, uint64_t misses)
+{
+    fprintf(stderr, "cache: %llu hits, %llu misses\n", (unsigned long long)hits, (unsigned long long)misses);
+}
+
+static int batch_parallel(FILE *in, const char *filename,
+                          const struct si5351_optimize_options *options,
+                          const struct cli_options *cli)
+{
+    struct si5351_plan_request *requests;
+    size_t nrequests = batch_read_all(in, filename, cli, &requests);
+    if (requests == NULL)
+        return EXIT_FAILURE;
+    int status = EXIT_FAILURE;
+
+    struct batch_queue queue = {
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .requests = requests,
+        .nchunks = (nrequests + BATCH_CHUNK_SIZE - 1) / BATCH_CHUNK_SIZE,
+    };
+    int njobs = cli->jobs;
+    struct batch_worker_arg *workers = calloc(njobs, sizeof(*workers));
+    pthread_t *threads = calloc(njobs, sizeof(*threads));
+    queue.chunks = calloc(queue.nchunks + 1, sizeof(*queue.chunks));
+    if (workers == NULL || threads == NULL || queue.chunks == NULL) {
+        perror("calloc");
+        goto done;
+    }
+    for (size_t n = 0; n < queue.nchunks; n++) {
+        queue.chunks[n].first = n * BATCH_CHUNK_SIZE;
+        queue.chunks[n].count = n + 1 < queue.nchunks ? BATCH_CHUNK_SIZE : nrequests - n * BATCH_CHUNK_SIZE;
+    }
+
+    int nstarted = 0;
+    for (int i = 0; i < njobs; i++) {
+        struct batch_worker_arg *worker = &workers[i];
+        worker->queue = &queue;
+        if (batch_state_init(&worker->state, options, cli) != SI5351_OK) {
+            fprintf(stderr, "cannot allocate the cache\n");
+            break;
+        }
+        int error = pthread_create(&threads[i], NULL, batch_worker, worker);
+        if (error != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(error));
+            batch_state_free(&worker->state);
+            break;
+        }
+        nstarted++;
+    }
+    /* the started workers drain the queue even if some failed to start */
+    status = nstarted > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    for (int i = 0; i < nstarted; i++) {
+        pthread_join(threads[i], NULL);
+        hits += workers[i].state.cache.hits;
+        misses += workers[i].state.cache.misses;
+        batch_state_free(&workers[i].state);
+        si5351_stats_add(&worker_stats, &workers[i].stats);
+    }
+    for (size_t n = 0; n < queue.nchunks; n++) {
+        struct batch_chunk *chunk = &queue.chunks[n];
+        if (chunk->status != SI5351_OK) {
+            fprintf(stderr, "%s: tuples %zu-%zu: %s\n", filename, chunk->first + 1, chunk->first + chunk->count, si5351_strerror(chunk->status));
+            status = EXIT_FAILURE;
+        }
+        if (status == EXIT_SUCCESS && chunk->output_size > 0)
+            fwrite(chunk->output, 1, chunk->output_size, stdout);
+        free(chunk->output);
+    }
+    fflush(stdout);
+    if (status == EXIT_SUCCESS && cli->cache_size > 0)
+        print_cache_stats(hits, misses);
+
+done:
+    free(queue.chunks);
+    free(threads);
+    free(workers);
+    free(requests);
+    return status;
+}
+
+static int batch(const char *filename, const struct si5351_optimize_options *options,
+                 const struct cli_options *cli)
+{
+    FILE *in = stdin;
+    if (strcmp(filename, "-") != 0) {
+        in = fopen(filename, "r");
+        if (in == NULL) {
+            perror(filename);
+            return EXIT_FAILURE;
+        }
+    }
+    static char outbuf[1 << 16];
+    setvbuf(stdout, outbuf, _IOFBF, sizeof(outbuf));
+    output_header(stdout, cli->format, cli->registers);
+
+    int status = EXIT_SUCCESS;
+    if (cli->jobs > 1) {
+        status = batch_parallel(in, filename, options, cli);
+    } else {
+        struct batch_state state;
+        if (batch_state_init(&state, options, cli) != SI5351_OK) {
+            fprintf(stderr, "cannot allocate the cache\n");
+            status = EXIT_FAILURE;
+        } else {
+            struct si5351_plan_request request;
+            int lineno = 0;
+            while (batch_read(in, filename, &lineno, cli, &request))
+                batch_record(stdout, &state, &request);
+            if (cli->cache_size > 0) {
+                fflush(stdout);
+                print_cache_stats(state.cache.hits, state.cache.misses);
             }
+            batch_state_free(&state);
+        }
+    }
+
+    if (in != stdin)
+        fclose(in);
+    return status;
+}
+
+
+/* hop schedule (see si5351_hop_schedule()): all the tuples of filename are
+ * planned first, then each hop is written as
+ *
+ *     xtal clk0 [clk1 ... clk7] npreload [reg:value ...] nswitch [reg:value ...]
+ *
+ * (or "xtal clk0 [clk1 ... clk7] error <reason>") where the npreload
+ * writes can be done any time during the previous hop and the nswitch ones
+ * are the hop itself
+ */
+static int hops(const char *filename, enum si5351_hop_mode mode,
+                const struct si5351_optimize_options *options,
+                const struct cli_options *cli)
+{
+    FILE *in = stdin;
+    if (strcmp(filename, "-") != 0) {
+        in = fopen(filename, "r");
+        if (in == NULL) {
+            perror(filename);
+            return EXIT_FAILURE;
+        }
+    }
+    struct si5351_plan_request *requests;
+    size_t nhops = batch_read_all(in, filename, cli, &requests);
+    if (in != stdin)
+        fclose(in);
+    if (requests == NULL)
+        return EXIT_FAILURE;
+    if (nhops > INT_MAX) {
+        fprintf(stderr, "%s: too many hops\n", filename);
+        free(requests);
+        return EXIT_FAILURE;
+    }
+
+    struct si5351_hop *schedule = malloc((nhops + 1) * sizeof(*schedule));
+    struct si5351_setup setup;
+    struct si5351_cache cache;
+    struct si5351_arena arena;
+    void *buffer = NULL;
+    memset(&setup, 0, sizeof(setup));
+    if (schedule == NULL || scratch_init(&arena, &buffer, cli->cache_size, options) != SI5351_OK) {
+        fprintf(stderr, "cannot allocate the hop schedule\n");
+        free(schedule);
+        free(requests);
+        return EXIT_FAILURE;
+    }
+    setup.arena = &arena;
+    if (cli->cache_size > 0) {
+        si5351_cache_init_arena(&cache, &arena, cli->cache_size);
+        setup.cache = &cache;
+    }
+
+    int nplanned = si5351_hop_schedule(&setup, options, mode, requests, (int)nhops, schedule);
+
+    static char outbuf[1 << 16];
+    setvbuf(stdout, outbuf, _IOFBF, sizeof(outbuf));
+    size_t switch_writes = 0;
+    int max_switch = 0;
+    for (size_t i = 0; i < nhops; i++) {
+        const struct si5351_plan_request *request = &requests[i];
+        const struct si5351_hop *hop = &schedule[i];
+        fprintf(stdout, "%.0f", request->xtal);
+        for (int nclk = 0; nclk < request->nclks; nclk++)
+            fprintf(stdout, " %.0f", request->clks[nclk]);
+        if (hop->status != SI5351_OK) {
+            fprintf(stdout, " error %s\n", si5351_strerror(hop->status));
+            continue;
+        }
+        fprintf(stdout, " %d", hop->npreload);
+        for (int w = 0; w < hop->npreload; w++)
+            fprintf(stdout, " %d:%02x", hop->writes[w].reg, hop->writes[w].value);
+        fprintf(stdout, " %d", hop->nswitch);
+        for (int w = hop->npreload; w < hop->npreload + hop->nswitch; w++)
+            fprintf(stdout, " %d:%02x", hop->writes[w].reg, hop->writes[w].value);
+        fprintf(stdout, "\n");
+        /* the first hop is the initial programming */
+        if (i > 0) {
+            switch_writes += hop->nswitch;
+            if (hop->nswitch > max_switch)
+                max_switch = hop->nswitch;
+        }
+    }
+    fflush(stdout);
+    fprintf(stderr, "hops: %d of %zu planned, %zu writes at the hops (max %d)\n", nplanned, nhops, switch_writes, max_switch);
+
+    free(buffer);
+    free(schedule);
+    free(requests);
+    return nplanned == (int)nhops ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* the table as C source: a const struct si5351e_table (si5351embedded.h)
+ * named after the xtal and the grid, for firmware images
+ */
+static int table_write_source(FILE *out, const struct si5351_table_header *table)
+{
+    if (table->xtal > UINT32_MAX || table->start + (uint64_t)table->count * table->step > UINT32_MAX) {
+        fprintf(stderr, "cannot write the table source: frequencies above 2^32 Hz\n");
+        return -1;
+    }
+    char name[64];
+    snprintf(name, sizeof(name), "si5351e_table_%llu_%llu_%llu",
+             (unsigned long long)table->xtal, (unsigned long long)table->start,
+             (unsigned long long)table->step);
+
+    const struct si5351_table_record *records = (const struct si5351_table_record *)(table + 1);
+    fprintf(out, "/* generated by si5351-experiments --table-source: xtal %llu, %u plans from %llu step %llu */\n\n",
+            (unsigned long long)table->xtal, table->count,
+            (unsigned long long)table->start, (unsigned long long)table->step);
+    fprintf(out, "#include \"si5351embedded.h\"\n\n");
+    fprintf(out, "static const struct si5351e_plan plans[%u] = {\n", table->count);
+    for (uint32_t i = 0; i < table->count; i++) {
+        const struct si5351_table_record *r = &records[i];
+        unsigned long long clk = table->start + i * table->step;
+        if (!(r->flags & SI5351_TABLE_VALID)) {
+            fprintf(out, "    {0, 0, 0, {0, 0, 0}, {0, 0, 0}},  /* %llu: no plan */\n", clk);
+            continue;
         }
-        uint32_t hn = an * h[1] + h[0];
-        uint32_t kn = an * k[1] + k[0];
-        h[0] = h[1]; h[1] = hn;
-        k[0] = k[1]; k[1] = kn;
+        fprintf(out, "    {%lluU, %u, %u, {%u, %u, %u}, {%u, %u, %u}},  /* %llu: %.3f ppb */\n",
+                (unsigned long long)table->xtal, r->clkin_div, r->rdiv,
+                r->feedback.a, r->feedback.b, r->feedback.c,
+                r->output.a, r->output.b, r->output.c, clk, r->ppb);
+    }
+    fprintf(out, "};\n\n");
+    fprintf(out, "const struct si5351e_table %s = {%lluU, %lluU, %uU, plans};\n", name,
+            (unsigned long long)table->start, (unsigned long long)table->step, table->count);
+    return 0;
+}
+
+/* precomputed plan table for start, start + step, ... start + (count - 1) step */
+static int table_generate(const char *filename, int source, char **args,
+                          const struct si5351_optimize_options *options)
+{
+    uint64_t xtal = strtoull(args[0], NULL, 10);
+    uint64_t start = strtoull(args[1], NULL, 10);
+    uint64_t step = strtoull(args[2], NULL, 10);
+    uint32_t count = (uint32_t)strtoul(args[3], NULL, 10);
+
+    size_t size = si5351_table_size(count);
+    void *table = malloc(size);
+    if (table == NULL) {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+    struct si5351_setup setup = {0};
+    int status = si5351_table_build(&setup, options, xtal, start, step, count, table);
+    if (status != SI5351_OK) {
+        fprintf(stderr, "cannot build the table: %s\n", si5351_strerror(status));
+        free(table);
+        return EXIT_FAILURE;
+    }
+
+    FILE *out = fopen(filename, source ? "w" : "wb");
+    if (out == NULL) {
+        perror(filename);
+        free(table);
+        return EXIT_FAILURE;
+    }
+    if (source) {
+        if (table_write_source(out, (const struct si5351_table_header *)table) < 0) {
+            fclose(out);
+            free(table);
+            return EXIT_FAILURE;
+        }
+    } else if (fwrite(table, size, 1, out) != 1) {
+        perror(filename);
+        fclose(out);
+        free(table);
+        return EXIT_FAILURE;
+    }
+    if (fclose(out) != 0) {
+        perror(filename);
+        free(table);
+        return EXIT_FAILURE;
+    }
+    free(table);
+    return EXIT_SUCCESS;
+}
+
+/* memory mapped and checked plan table (NULL on errors) */
+static const void *table_map(const char *filename, size_t *size)
+{
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(filename);
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror(filename);
+        return NULL;
+    }
+    if (si5351_table_check(data, st.st_size) != SI5351_OK) {
+        fprintf(stderr, "%s: invalid table\n", filename);
+        munmap(data, st.st_size);
+        return NULL;
+    }
+    *size = st.st_size;
+    return data;
+}
+
+static int table_lookup(const char *filename, int nfreqs, char **freqs)
+{
+    size_t size;
+    const struct si5351_table_header *table = table_map(filename, &size);
+    if (table == NULL)
+        return EXIT_FAILURE;
+
+    for (int i = 0; i < nfreqs; i++) {
+        uint64_t freq = strtoull(freqs[i], NULL, 10);
+        const struct si5351_table_record *record = si5351_table_lookup(table, freq);
+        if (record == NULL) {
+            fprintf(stdout, "%llu no plan\n", (unsigned long long)freq);
+            continue;
+        }
+        fprintf(stdout, "%llu clkin_div=%d feedback=%u+%u/%u output=%u+%u/%u rdiv=%d ppb=%.3g\n", (unsigned long long)freq, record->clkin_div, record->feedback.a, record->feedback.b, record->feedback.c, record->output.a, record->output.b, record->output.c, record->rdiv, record->ppb);
+    }
+    munmap((void *)table, size);
+    return EXIT_SUCCESS;
+}
+
+
+/* long running server (see si5351-server.c) */
+static int serve(const char *socket_path, const char *lookup_file,
+                 const struct si5351_optimize_options *options,
+                 const struct cli_options *cli)
+{
+    struct server_options server = {
+        .options = options,
+        .cache_size = cli->cache_size,
+        .incremental = cli->incremental,
+    };
+    size_t size = 0;
+    if (lookup_file != NULL) {
+        server.table = table_map(lookup_file, &size);
+        if (server.table == NULL)
+            return EXIT_FAILURE;
     }
-    return;
+    int status = server_run(socket_path, &server);
+    if (server.table != NULL)
+        munmap((void *)server.table, size);
+    return status;
 }
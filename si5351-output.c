@@ -0,0 +1,249 @@
+/* machine readable input and output for si5351-experiments
+ *
+ * Copyright 2024, Franco Venturi, K4VZ
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "si5351plan.h"
+#include "si5351-output.h"
+
+/* frequencies and differences are written with %.17g so they round trip;
+ * none of the formats use locale dependent grouping
+ */
+
+int input_request(const char *line, struct si5351_plan_request *request)
+{
+    /* xtal and up to SI5351_MAX_CLOCKS clocks */
+    int n = 0;
+    while (n <= SI5351_MAX_CLOCKS) {
+        char *end;
+        double value = strtod(line, &end);
+        if (end == line)
+            break;
+        if (n == 0)
+            request->xtal = value;
+        else
+            request->clks[n - 1] = value;
+        n++;
+        line = end;
+    }
+    request->nclks = n - 1;
+    return n >= 2;
+}
+
+int output_format(const char *name)
+{
+    if (strcmp(name, "text") == 0)
+        return OUTPUT_TEXT;
+    if (strcmp(name, "csv") == 0)
+        return OUTPUT_CSV;
+    if (strcmp(name, "jsonl") == 0)
+        return OUTPUT_JSONL;
+    if (strcmp(name, "bin") == 0)
+        return OUTPUT_BIN;
+    return -1;
+}
+
+void output_image(FILE *out, const struct si5351_plan_result *plan)
+{
+    uint8_t image[SI5351_REG_IMAGE_SIZE];
+    si5351_register_image(plan, image);
+    for (int i = 0; i < SI5351_REG_IMAGE_SIZE; i++)
+        fprintf(out, "%02x", image[i]);
+}
+
+void output_header(FILE *out, int format, int registers)
+{
+    if (format != OUTPUT_CSV)
+        return;
+    fprintf(out, "xtal");
+    for (int nclk = 0; nclk < SI5351_MAX_CLOCKS; nclk++)
+        fprintf(out, ",clk%d", nclk);
+    fprintf(out, ",status,scenario,clkin_div");
+    for (int pll = SI5351_PLLA; pll <= SI5351_PLLB; pll++)
+        fprintf(out, ",pll%c_freq,pll%c_a,pll%c_b,pll%c_c", 'a' + pll, 'a' + pll, 'a' + pll, 'a' + pll);
+    for (int nclk = 0; nclk < SI5351_MAX_CLOCKS; nclk++)
+        fprintf(out, ",clk%d_pll,ms%d_a,ms%d_b,ms%d_c,r%d_div,clk%d_actual,clk%d_diff", nclk, nclk, nclk, nclk, nclk, nclk, nclk);
+    fprintf(out, ",max_clk_diff,max_ppb,cost,nfractional,nodd,max_denominator,vco_margin");
+    if (registers)
+        fprintf(out, ",registers");
+    fprintf(out, "\n");
+}
+
+static void csv_record(FILE *out, int registers,
+                       const struct si5351_plan_request *request, int status,
+                       const struct si5351_plan_result *plan)
+{
+    fprintf(out, "%.17g", request->xtal);
+    for (int nclk = 0; nclk < SI5351_MAX_CLOCKS; nclk++) {
+        if (nclk < request->nclks)
+            fprintf(out, ",%.17g", request->clks[nclk]);
+        else
+            fprintf(out, ",");
+    }
+    fprintf(out, ",%s", si5351_strerror(status));
+    if (plan == NULL) {
+        /* scenario ... vco_margin */
+        int nfields = 2 + 4 * 2 + 7 * SI5351_MAX_CLOCKS + 7 + (registers ? 1 : 0);
+        for (int i = 0; i < nfields; i++)
+            fprintf(out, ",");
+        fprintf(out, "\n");
+        return;
+    }
+
+    fprintf(out, ",%d,%d", plan->scenario, plan->clkin_div);
+    for (int pll = SI5351_PLLA; pll <= SI5351_PLLB; pll++) {
+        const struct si5351_ms *fb = &plan->feedback[pll];
+        if (plan->pll_freq[pll] == 0)
+            fprintf(out, ",0,,,");
+        else
+            fprintf(out, ",%.17g,%u,%u,%u", plan->pll_freq[pll], fb->a, fb->b, fb->c);
+    }
+    for (int nclk = 0; nclk < SI5351_MAX_CLOCKS; nclk++) {
+        const struct si5351_ms *ms = &plan->output[nclk];
+        if (nclk >= plan->nclks || status != SI5351_OK)
+            fprintf(out, ",,,,,,,");
+        else if (!plan->valid[nclk])
+            fprintf(out, ",%d,,,,,,", plan->pll[nclk]);
+        else
+            fprintf(out, ",%d,%u,%u,%u,%d,%.17g,%.17g", plan->pll[nclk], ms->a, ms->b, ms->c, plan->rdiv[nclk], plan->actual[nclk], plan->clk_diff[nclk]);
+    }
+    if (status != SI5351_OK)
+        fprintf(out, ",,,,,,,");
+    else
+        fprintf(out, ",%.17g,%.17g,%.17g,%d,%d,%u,%.17g", plan->max_clk_diff, plan->max_ppb, plan->cost, plan->quality.nfractional, plan->quality.nodd, plan->quality.max_denominator, plan->quality.vco_margin);
+    if (registers) {
+        fprintf(out, ",");
+        if (status == SI5351_OK)
+            output_image(out, plan);
+    }
+    fprintf(out, "\n");
+}
+
+/* JSON has no infinity */
+static void json_number(FILE *out, const char *name, double value)
+{
+    if (isfinite(value))
+        fprintf(out, ",\"%s\":%.17g", name, value);
+    else
+        fprintf(out, ",\"%s\":null", name);
+}
+
+static void jsonl_record(FILE *out, int registers,
+                         const struct si5351_plan_request *request, int status,
+                         const struct si5351_plan_result *plan)
+{
+    fprintf(out, "{\"xtal\":%.17g,\"clks\":[", request->xtal);
+    for (int nclk = 0; nclk < request->nclks; nclk++)
+        fprintf(out, "%s%.17g", nclk > 0 ? "," : "", request->clks[nclk]);
+    fprintf(out, "],\"status\":\"%s\"", si5351_strerror(status));
+    if (plan == NULL || status != SI5351_OK) {
+        if (plan != NULL)
+            fprintf(out, ",\"scenario\":%d,\"vco\":%.17g", plan->scenario, plan->pll_freq[SI5351_PLLA]);
+        fprintf(out, "}\n");
+        return;
+    }
+
+    fprintf(out, ",\"scenario\":%d,\"clkin_div\":%d,\"plls\":[", plan->scenario, plan->clkin_div);
+    for (int pll = SI5351_PLLA; pll <= SI5351_PLLB; pll++) {
+        const struct si5351_ms *fb = &plan->feedback[pll];
+        if (pll > SI5351_PLLA)
+            fprintf(out, ",");
+        if (plan->pll_freq[pll] == 0)
+            fprintf(out, "null");
+        else
+            fprintf(out, "{\"freq\":%.17g,\"a\":%u,\"b\":%u,\"c\":%u}", plan->pll_freq[pll], fb->a, fb->b, fb->c);
+    }
+    fprintf(out, "],\"outputs\":[");
+    for (int nclk = 0; nclk < plan->nclks; nclk++) {
+        const struct si5351_ms *ms = &plan->output[nclk];
+        if (nclk > 0)
+            fprintf(out, ",");
+        if (!plan->valid[nclk]) {
+            fprintf(out, "null");
+            continue;
+        }
+        fprintf(out, "{\"pll\":%d,\"a\":%u,\"b\":%u,\"c\":%u,\"rdiv\":%d", plan->pll[nclk], ms->a, ms->b, ms->c, plan->rdiv[nclk]);
+        json_number(out, "actual", plan->actual[nclk]);
+        json_number(out, "diff", plan->clk_diff[nclk]);
+        fprintf(out, "}");
+    }
+    fprintf(out, "]");
+    json_number(out, "max_clk_diff", plan->max_clk_diff);
+    json_number(out, "max_ppb", plan->max_ppb);
+    json_number(out, "cost", plan->cost);
+    fprintf(out, ",\"quality\":{\"nfractional\":%d,\"nodd\":%d,\"max_denominator\":%u", plan->quality.nfractional, plan->quality.nodd, plan->quality.max_denominator);
+    json_number(out, "vco_margin", plan->quality.vco_margin);
+    fprintf(out, "}");
+    if (registers) {
+        fprintf(out, ",\"registers\":\"");
+        output_image(out, plan);
+        fprintf(out, "\"");
+    }
+    fprintf(out, "}\n");
+}
+
+static void bin_record(FILE *out, const struct si5351_plan_request *request,
+                       int status, const struct si5351_plan_result *plan)
+{
+    struct output_record record;
+    memset(&record, 0, sizeof(record));
+    record.xtal = request->xtal;
+    record.nclks = (uint8_t)request->nclks;
+    for (int nclk = 0; nclk < request->nclks; nclk++)
+        record.clks[nclk] = request->clks[nclk];
+    record.status = status;
+    if (plan != NULL) {
+        record.scenario = plan->scenario;
+        record.clkin_div = plan->clkin_div;
+        record.max_clk_diff = plan->max_clk_diff;
+        record.max_ppb = plan->max_ppb;
+        record.cost = plan->cost;
+        if (status == SI5351_OK) {
+            record.vco_margin = plan->quality.vco_margin;
+            record.max_denominator = plan->quality.max_denominator;
+            record.nfractional = plan->quality.nfractional;
+            record.nodd = plan->quality.nodd;
+        }
+        for (int pll = SI5351_PLLA; pll <= SI5351_PLLB; pll++) {
+            record.pll_freq[pll] = plan->pll_freq[pll];
+            if (plan->pll_freq[pll] != 0)
+                record.feedback[pll] = plan->feedback[pll];
+        }
+        for (int nclk = 0; status == SI5351_OK && nclk < plan->nclks; nclk++) {
+            record.pll[nclk] = plan->pll[nclk];
+            record.valid[nclk] = plan->valid[nclk];
+            if (!plan->valid[nclk])
+                continue;
+            record.output[nclk] = plan->output[nclk];
+            record.rdiv[nclk] = plan->rdiv[nclk];
+            record.actual[nclk] = plan->actual[nclk];
+            record.clk_diff[nclk] = plan->clk_diff[nclk];
+        }
+    }
+    fwrite(&record, sizeof(record), 1, out);
+}
+
+void output_record(FILE *out, int format, int registers,
+                   const struct si5351_plan_request *request, int status,
+                   const struct si5351_plan_result *plan)
+{
+    switch (format) {
+    case OUTPUT_CSV:
+        csv_record(out, registers, request, status, plan);
+        break;
+    case OUTPUT_JSONL:
+        jsonl_record(out, registers, request, status, plan);
+        break;
+    case OUTPUT_BIN:
+        bin_record(out, request, status, plan);
+        break;
+    }
+}
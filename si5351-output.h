@@ -0,0 +1,70 @@
+/* machine readable input and output for si5351-experiments
+ *
+ * Copyright 2024, Franco Venturi, K4VZ
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef SI5351_OUTPUT_H
+#define SI5351_OUTPUT_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "si5351plan.h"
+
+enum output_format {
+    OUTPUT_TEXT,                /* the original human readable output */
+    OUTPUT_CSV,                 /* header line + one line per record */
+    OUTPUT_JSONL,               /* one JSON object per line */
+    OUTPUT_BIN,                 /* struct output_record, host byte order */
+};
+
+/* binary record; fields past nclks and unused PLLs are zero */
+struct output_record {
+    double xtal;
+    double clks[SI5351_MAX_CLOCKS];
+    double pll_freq[2];
+    double actual[SI5351_MAX_CLOCKS];
+    double clk_diff[SI5351_MAX_CLOCKS];
+    double max_clk_diff;
+    double max_ppb;
+    double cost;
+    double vco_margin;          /* plan quality (see struct si5351_plan_quality) */
+    struct si5351_ms feedback[2];
+    struct si5351_ms output[SI5351_MAX_CLOCKS];
+    int32_t status;             /* enum si5351_status */
+    int32_t scenario;
+    uint32_t max_denominator;
+    uint8_t nclks;
+    uint8_t clkin_div;
+    uint8_t pll[SI5351_MAX_CLOCKS];
+    uint8_t rdiv[SI5351_MAX_CLOCKS];
+    uint8_t valid[SI5351_MAX_CLOCKS];
+    uint8_t nfractional;
+    uint8_t nodd;
+};
+
+/* "xtal clk0 [clk1 ... clk7]" at the start of line (anything after that
+ * is ignored); returns 0 without xtal and clk0
+ */
+int input_request(const char *line, struct si5351_plan_request *request);
+
+/* returns -1 if name is not a known format */
+int output_format(const char *name);
+
+/* CSV header (nothing for the other formats) */
+void output_header(FILE *out, int format, int registers);
+
+/* one record for request: plan is NULL when status is an error for the
+ * whole request, otherwise status is plan->status (a rejected candidate
+ * or SI5351_OK); registers adds the register image (CSV and JSON Lines)
+ */
+void output_record(FILE *out, int format, int registers,
+                   const struct si5351_plan_request *request, int status,
+                   const struct si5351_plan_result *plan);
+
+/* register image in hex */
+void output_image(FILE *out, const struct si5351_plan_result *plan);
+
+#endif /* SI5351_OUTPUT_H */
@@ -0,0 +1,57 @@
+#!/bin/sh
+# perf profile of a batch sweep with the profile build (make profile)
+#
+# usage: si5351-profile.sh [BUILD_DIR [OUT_DIR]]
+#
+# writes to OUT_DIR (default perf-out):
+#   sweep.txt       the sweep tuples
+#   perf.data       perf record with frame pointer call graphs
+#   report.txt      self time per function
+#   callers.txt     time per function with its callees
+#   flamegraph.svg  if stackcollapse-perf.pl and flamegraph.pl are in PATH
+#                   (or in FLAMEGRAPH_DIR)
+#
+# the sweep is planned with CSV output, so the time splits between the
+# scenario loops, the rational approximations and the output formatting
+
+set -e
+
+BUILD_DIR=${1:-build/profile}
+OUT_DIR=${2:-perf-out}
+PERF_FREQ=${PERF_FREQ:-4999}
+
+if ! command -v perf > /dev/null; then
+    echo "perf not found" >&2
+    exit 1
+fi
+if [ ! -x "$BUILD_DIR/si5351-experiments" ]; then
+    echo "$BUILD_DIR/si5351-experiments not found (run make profile)" >&2
+    exit 1
+fi
+mkdir -p "$OUT_DIR"
+
+# 100000 tuples: one clock across the HF bands, and the same with two
+# fixed clocks (so the optimizer has PLL sharing to work on)
+awk 'BEGIN {
+    for (i = 0; i < 50000; i++) {
+        clk = 1000000 + i * 599
+        print "25000000", clk
+        print "25000000", clk, 66672000, 10000000
+    }
+}' > "$OUT_DIR/sweep.txt"
+
+perf record -F "$PERF_FREQ" --call-graph=fp -o "$OUT_DIR/perf.data" -- \
+    "$BUILD_DIR/si5351-experiments" -b --format=csv "$OUT_DIR/sweep.txt" > /dev/null
+perf report -i "$OUT_DIR/perf.data" --stdio --no-children --sort=symbol > "$OUT_DIR/report.txt"
+perf report -i "$OUT_DIR/perf.data" --stdio --children --sort=symbol -g none > "$OUT_DIR/callers.txt"
+
+if [ -n "$FLAMEGRAPH_DIR" ]; then
+    PATH="$FLAMEGRAPH_DIR:$PATH"
+fi
+if command -v stackcollapse-perf.pl > /dev/null && command -v flamegraph.pl > /dev/null; then
+    perf script -i "$OUT_DIR/perf.data" | stackcollapse-perf.pl | flamegraph.pl > "$OUT_DIR/flamegraph.svg"
+else
+    echo "flamegraph.pl not found, skipping $OUT_DIR/flamegraph.svg" >&2
+fi
+
+head -40 "$OUT_DIR/report.txt"
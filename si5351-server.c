@@ -0,0 +1,436 @@
+/* persistent planning server for si5351-experiments
+ *
+ * Copyright 2024, Franco Venturi, K4VZ
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "si5351plan.h"
+#include "si5351-output.h"
+#include "si5351-server.h"
+
+/* line protocol: every request line gets exactly one reply line, in
+ * order, so clients can pipeline their requests:
+ *
+ *     xtal clk0 [clk1 ... clk7]   ok max_clk_diff registers
+ *                                 ok pll_reset nwrites [reg:value ...]
+ *                                 error reason
+ *     stats                       ok reply_hits reply_misses cache_hits cache_misses
+ *
+ * registers is the register image (SI5351_REG_IMAGE_FIRST..) of the best
+ * si5351_optimize() plan in hex; with options->incremental the reply is
+ * instead the register writes from the previous plan of the same client,
+ * as in the batch mode. Blank lines get no reply.
+ *
+ * A single thread serves all the clients with poll(), so the setup, the
+ * rational approximation cache and a direct mapped cache of the replies
+ * are shared by all of them for the life of the server: a frequency set
+ * that was already planned is answered without planning it again. Single
+ * clock requests on the grid of options->table (same xtal) come from the
+ * table, which should be built with the same optimizer options.
+ */
+
+#define SERVER_MAX_CLIENTS 16
+#define SERVER_LINE_SIZE 256
+#define SERVER_REPLY_SIZE (32 + 6 * SI5351_REG_IMAGE_SIZE)
+
+/* power of 2 */
+static const uint32_t REPLY_CACHE_SIZE = 4096;
+
+struct reply_entry {
+    struct si5351_plan_request request;
+    int length;                 /* 0: empty */
+    char reply[32 + 2 * SI5351_REG_IMAGE_SIZE];
+};
+
+struct client {
+    int in;                     /* -1: free slot */
+    int out;
+    char line[SERVER_LINE_SIZE];
+    size_t length;
+    int overlong;               /* discarding until the end of the line */
+    struct si5351_plan_result previous;     /* options->incremental */
+    int have_previous;
+    uint8_t image[SI5351_REG_IMAGE_SIZE];
+};
+
+struct server {
+    const struct server_options *options;
+    struct si5351_optimize_options single;
+    struct si5351_setup setup;
+    struct si5351_cache cache;
+    struct si5351_arena arena;  /* the cache entries and optimizer scratch */
+    void *buffer;
+    struct reply_entry *replies;
+    uint64_t reply_hits;
+    uint64_t reply_misses;
+    struct client clients[SERVER_MAX_CLIENTS];
+};
+
+static volatile sig_atomic_t stop;
+
+static void stop_handler(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+
+static uint32_t request_hash(const struct si5351_plan_request *request)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    uint64_t bits;
+    memcpy(&bits, &request->xtal, sizeof(bits));
+    hash = (hash ^ bits) * 0x100000001b3ULL;
+    for (int nclk = 0; nclk < request->nclks; nclk++) {
+        memcpy(&bits, &request->clks[nclk], sizeof(bits));
+        hash = (hash ^ bits) * 0x100000001b3ULL;
+    }
+    return (uint32_t)(hash ^ (hash >> 32)) & (REPLY_CACHE_SIZE - 1);
+}
+
+static int same_request(const struct si5351_plan_request *r1,
+                        const struct si5351_plan_request *r2)
+{
+    return r1->xtal == r2->xtal && r1->nclks == r2->nclks &&
+           memcmp(r1->clks, r2->clks, r1->nclks * sizeof(r1->clks[0])) == 0;
+}
+
+static int hex_image(char *out, const struct si5351_plan_result *plan)
+{
+    static const char digits[] = "0123456789abcdef";
+    uint8_t image[SI5351_REG_IMAGE_SIZE];
+    si5351_register_image(plan, image);
+    for (int i = 0; i < SI5351_REG_IMAGE_SIZE; i++) {
+        out[2 * i] = digits[image[i] >> 4];
+        out[2 * i + 1] = digits[image[i] & 0x0f];
+    }
+    return 2 * SI5351_REG_IMAGE_SIZE;
+}
+
+/* the table record for a single clock on its grid, as a plan */
+static int table_plan(const struct si5351_table_header *table,
+                      const struct si5351_plan_request *request,
+                      struct si5351_plan_result *plan)
+{
+    if (table == NULL || request->nclks != 1 || request->xtal != (double)table->xtal)
+        return 0;
+    uint64_t freq = (uint64_t)request->clks[0];
+    if ((double)freq != request->clks[0] || freq < table->start || (freq - table->start) % table->step != 0)
+        return 0;
+    const struct si5351_table_record *record = si5351_table_lookup(table, freq);
+    if (record == NULL)
+        return 0;
+
+    const struct si5351_ms *fb = &record->feedback;
+    memset(plan, 0, sizeof(*plan));
+    plan->status = SI5351_OK;
+    plan->nclks = 1;
+    plan->clkin_div = record->clkin_div;
+    plan->pll_freq[SI5351_PLLA] = request->xtal / (1 << record->clkin_div) * (fb->a + (double)fb->b / fb->c);
+    plan->feedback[SI5351_PLLA] = *fb;
+    plan->feedback[SI5351_PLLB] = (struct si5351_ms){0, 0, 1};
+    plan->output[0] = record->output;
+    plan->rdiv[0] = record->rdiv;
+    plan->valid[0] = 1;
+    plan->clks[0] = request->clks[0];
+    plan->clk_diff[0] = record->ppb * 1e-9 * request->clks[0];
+    plan->actual[0] = request->clks[0] + plan->clk_diff[0];
+    plan->max_clk_diff = fabsf(record->ppb) * 1e-9 * request->clks[0];
+    plan->max_ppb = fabsf(record->ppb);
+    si5351_plan_quality(plan, &plan->quality);
+    return 1;
+}
+
+static int plan_request(struct server *server, const struct si5351_plan_request *request,
+                        struct si5351_plan_result *plan)
+{
+    if (table_plan(server->options->table, request, plan))
+        return SI5351_OK;
+    int status = si5351_optimize(&server->setup, request, &server->single, plan);
+    return status < 0 ? status : SI5351_OK;
+}
+
+/* reply (without the newline) for a request line; returns its length */
+static int handle_request(struct server *server, struct client *client,
+                          const char *line, char *reply)
+{
+    struct si5351_plan_request request;
+
+    if (strncmp(line, "stats", 5) == 0)
+        return sprintf(reply, "ok %llu %llu %llu %llu", (unsigned long long)server->reply_hits, (unsigned long long)server->reply_misses, (unsigned long long)server->cache.hits, (unsigned long long)server->cache.misses);
+    if (!input_request(line, &request))
+        return sprintf(reply, "error expected xtal clk0 [clk1 ... clk7]");
+
+    if (server->options->incremental) {
+        struct si5351_plan_result plan;
+        int pll_reset;
+        int status = si5351_retune(&server->setup, &server->single, client->have_previous ? &client->previous : NULL, &request, &plan, &pll_reset);
+        if (status != SI5351_OK)
+            return sprintf(reply, "error %s", si5351_strerror(status));
+        client->previous = plan;
+        client->have_previous = 1;
+
+        uint8_t image[SI5351_REG_IMAGE_SIZE];
+        struct si5351_reg_write writes[SI5351_REG_IMAGE_SIZE];
+        si5351_register_image(&plan, image);
+        int nwrites = si5351_register_delta(client->image, image, writes);
+        memcpy(client->image, image, sizeof(image));
+        int length = sprintf(reply, "ok %d %d", pll_reset, nwrites);
+        for (int i = 0; i < nwrites; i++)
+            length += sprintf(reply + length, " %d:%02x", writes[i].reg, writes[i].value);
+        return length;
+    }
+
+    struct reply_entry *entry = &server->replies[request_hash(&request)];
+    if (entry->length > 0 && same_request(&entry->request, &request)) {
+        server->reply_hits++;
+        memcpy(reply, entry->reply, entry->length);
+        return entry->length;
+    }
+    server->reply_misses++;
+
+    struct si5351_plan_result plan;
+    int status = plan_request(server, &request, &plan);
+    int length;
+    if (status != SI5351_OK) {
+        length = sprintf(reply, "error %s", si5351_strerror(status));
+    } else {
+        length = sprintf(reply, "ok %.3g ", plan.max_clk_diff);
+        length += hex_image(reply + length, &plan);
+    }
+    entry->request = request;
+    entry->length = length;
+    memcpy(entry->reply, reply, length);
+    return length;
+}
+
+
+static int write_all(int fd, const char *data, size_t size)
+{
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += n;
+        size -= n;
+    }
+    return 0;
+}
+
+static void close_client(struct client *client)
+{
+    if (client->in > STDERR_FILENO)
+        close(client->in);
+    client->in = -1;
+}
+
+static void open_client(struct client *client, int in, int out)
+{
+    memset(client, 0, sizeof(*client));
+    client->in = in;
+    client->out = out;
+}
+
+/* everything readable from the client; all the replies for its complete
+ * lines go out with a single write. Returns -1 at end of file
+ */
+static int serve_client(struct server *server, struct client *client)
+{
+    char buffer[4096];
+    static char replies[64 * (SERVER_REPLY_SIZE + 1)];
+    size_t nreplies = 0;
+
+    ssize_t n = read(client->in, buffer, sizeof(buffer));
+    if (n < 0)
+        return errno == EINTR ? 0 : -1;
+    if (n == 0)
+        return -1;
+
+    for (ssize_t i = 0; i < n; i++) {
+        char c = buffer[i];
+        if (c != '\n') {
+            if (client->length + 1 < sizeof(client->line))
+                client->line[client->length++] = c;
+            else
+                client->overlong = 1;
+            continue;
+        }
+
+        client->line[client->length] = '\0';
+        const char *line = client->line;
+        while (*line == ' ' || *line == '\t' || *line == '\r')
+            line++;
+        if (client->overlong) {
+            nreplies += sprintf(replies + nreplies, "error line too long\n");
+        } else if (*line != '\0') {
+            nreplies += handle_request(server, client, line, replies + nreplies);
+            replies[nreplies++] = '\n';
+        }
+        client->length = 0;
+        client->overlong = 0;
+
+        /* room for at least one more reply */
+        if (nreplies > sizeof(replies) - SERVER_REPLY_SIZE - 1) {
+            if (write_all(client->out, replies, nreplies) < 0)
+                return -1;
+            nreplies = 0;
+        }
+    }
+    if (nreplies > 0 && write_all(client->out, replies, nreplies) < 0)
+        return -1;
+    return 0;
+}
+
+static int open_socket(const char *path)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "%s: socket path too long\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    /* replace a stale socket from a previous run, but nothing else */
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, SERVER_MAX_CLIENTS) < 0) {
+        perror(path);
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int server_run(const char *socket_path, const struct server_options *options)
+{
+    struct server *server = calloc(1, sizeof(*server));
+    if (server == NULL) {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
+    server->options = options;
+    server->single = *options->options;
+    server->single.top_k = 1;
+    server->replies = calloc(REPLY_CACHE_SIZE, sizeof(*server->replies));
+    int status = EXIT_FAILURE;
+    if (server->replies == NULL) {
+        perror("calloc");
+        goto done;
+    }
+    /* sized for any request, so planning does not allocate */
+    size_t scratch_size = si5351_optimize_scratch_size(SI5351_MAX_CLOCKS, &server->single);
+    if (options->cache_size > 0)
+        scratch_size += si5351_cache_arena_size(options->cache_size);
+    server->buffer = malloc(scratch_size);
+    if (server->buffer == NULL) {
+        fprintf(stderr, "cannot allocate the planner scratch memory\n");
+        goto done;
+    }
+    si5351_arena_init(&server->arena, server->buffer, scratch_size);
+    server->setup.arena = &server->arena;
+    if (options->cache_size > 0) {
+        si5351_cache_init_arena(&server->cache, &server->arena, options->cache_size);
+        server->setup.cache = &server->cache;
+    }
+    for (int i = 0; i < SERVER_MAX_CLIENTS; i++)
+        server->clients[i].in = -1;
+
+    int listen_fd = -1;
+    if (socket_path == NULL) {
+        open_client(&server->clients[0], STDIN_FILENO, STDOUT_FILENO);
+    } else {
+        listen_fd = open_socket(socket_path);
+        if (listen_fd < 0)
+            goto done;
+        struct sigaction sa = {.sa_handler = stop_handler};
+        sigaction(SIGINT, &sa, NULL);
+        sigaction(SIGTERM, &sa, NULL);
+    }
+    /* a client going away is just a failed write */
+    signal(SIGPIPE, SIG_IGN);
+
+    status = EXIT_SUCCESS;
+    while (!stop) {
+        struct pollfd fds[SERVER_MAX_CLIENTS + 1];
+        int slots[SERVER_MAX_CLIENTS + 1];
+        int nfds = 0;
+        int nclients = 0;
+        for (int i = 0; i < SERVER_MAX_CLIENTS; i++) {
+            if (server->clients[i].in < 0)
+                continue;
+            fds[nfds] = (struct pollfd){.fd = server->clients[i].in, .events = POLLIN};
+            slots[nfds++] = i;
+            nclients++;
+        }
+        if (listen_fd < 0 && nclients == 0)
+            break;
+        if (listen_fd >= 0) {
+            /* stop accepting while every slot is busy */
+            fds[nfds] = (struct pollfd){.fd = nclients < SERVER_MAX_CLIENTS ? listen_fd : -1, .events = POLLIN};
+            slots[nfds++] = -1;
+        }
+
+        if (poll(fds, nfds, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            status = EXIT_FAILURE;
+            break;
+        }
+        for (int i = 0; i < nfds; i++) {
+            if (fds[i].revents == 0)
+                continue;
+            if (slots[i] >= 0) {
+                struct client *client = &server->clients[slots[i]];
+                if (serve_client(server, client) < 0)
+                    close_client(client);
+                continue;
+            }
+            int fd = accept(listen_fd, NULL, NULL);
+            if (fd < 0)
+                continue;
+            for (int slot = 0; slot < SERVER_MAX_CLIENTS; slot++) {
+                if (server->clients[slot].in < 0) {
+                    open_client(&server->clients[slot], fd, fd);
+                    break;
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < SERVER_MAX_CLIENTS; i++) {
+        if (server->clients[i].in >= 0)
+            close_client(&server->clients[i]);
+    }
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        unlink(socket_path);
+    }
+
+done:
+    free(server->buffer);
+    free(server->replies);
+    free(server);
+    return status;
+}
@@ -0,0 +1,28 @@
+/* persistent planning server for si5351-experiments
+ *
+ * Copyright 2024, Franco Venturi, K4VZ
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef SI5351_SERVER_H
+#define SI5351_SERVER_H
+
+#include <stdint.h>
+
+#include "si5351plan.h"
+
+struct server_options {
+    const struct si5351_optimize_options *options;
+    const struct si5351_table_header *table;    /* optional (--lookup) */
+    uint32_t cache_size;        /* rational approximation cache entries */
+    int incremental;            /* reply with the register writes */
+};
+
+/* answer requests on stdin/stdout (socket_path NULL) until end of file, or
+ * on a Unix domain socket until SIGINT or SIGTERM; returns EXIT_SUCCESS or
+ * EXIT_FAILURE
+ */
+int server_run(const char *socket_path, const struct server_options *options);
+
+#endif /* SI5351_SERVER_H */
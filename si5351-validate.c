@@ -0,0 +1,728 @@
+/* validation of the rational approximation solvers against brute force
+ *
+ * Copyright 2024, Franco Venturi, K4VZ
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "si5351plan.h"
+#include "si5351embedded.h"
+
+/* every ratio num / den of the set is approximated by each solver and by
+ * an oracle that tries every denominator up to MAX_DENOMINATOR; a solver
+ * result is a mismatch if it is further from num / den than the oracle
+ * one (or not a valid a + b/c), and a tie if it is a different fraction at
+ * the same distance. One line per solver:
+ *
+ *     name ratios mismatches ties ns/call speedup
+ *
+ * where speedup is over the oracle. The ratios are generated from their
+ * index alone, so any -j gives the same set, cycling through the kinds of
+ * the ratio_kinds[] table. Exits with EXIT_FAILURE on any mismatch of an
+ * exact solver; the double si5351_rational_approximation() stops at its
+ * epsilon, so its mismatches are only reported. The last lines
+ *
+ *     candidates count mismatches
+ *     optimizer count mismatches
+ *     low_clocks count mismatches
+ *     setup count mismatches
+ *     fine_tune count mismatches
+ *     clkin_div count mismatches
+ *
+ * check the valid flags of the planner candidates for the plan_checks[]
+ * requests, the output MS and R divider ranges of the optimizer plans for
+ * the optimize_checks[] requests and of the si5351_plan() plans for the
+ * low_clock_checks[] clocks, the status of out of range requests on a
+ * fresh and on a used setup, the si5351_fine_tune() error bound and the
+ * embedded planner CLKIN_DIV against the library; any mismatch is a
+ * failure too
+ */
+
+__extension__ typedef unsigned __int128 u128;
+
+static const uint32_t MAX_DENOMINATOR = 1048575;
+static const uint32_t CACHE_SIZE = 4096;
+/* mismatches printed per solver */
+static const int MAX_REPORTED = 5;
+
+struct ratio {
+    uint64_t num;
+    uint64_t den;
+};
+
+static uint64_t xorshift64(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+/* x in [min, max] */
+static uint64_t range(uint64_t *state, uint64_t min, uint64_t max)
+{
+    return min + xorshift64(state) % (max - min + 1);
+}
+
+static uint64_t gcd(uint64_t a, uint64_t b)
+{
+    while (b != 0) {
+        uint64_t r = a % b;
+        a = b;
+        b = r;
+    }
+    return a;
+}
+
+/* inverse of a modulo m (gcd(a, m) = 1) */
+static uint64_t inverse(uint64_t a, uint64_t m)
+{
+    int64_t t = 0, new_t = 1;
+    int64_t r = (int64_t)m, new_r = (int64_t)(a % m);
+    while (new_r != 0) {
+        int64_t q = r / new_r;
+        int64_t tmp = t - q * new_t;
+        t = new_t;
+        new_t = tmp;
+        tmp = r - q * new_r;
+        r = new_r;
+        new_r = tmp;
+    }
+    return (uint64_t)(t < 0 ? t + (int64_t)m : t);
+}
+
+/* output MS of an integer Hz clock from an integer Hz VCO */
+static void output_ratio(uint64_t *state, struct ratio *ratio)
+{
+    ratio->num = range(state, 600000000, 1000000000);
+    ratio->den = range(state, ratio->num / 900 + 1, ratio->num / 4);
+}
+
+/* feedback MS of an integer Hz VCO from the xtal */
+static void feedback_ratio(uint64_t *state, struct ratio *ratio)
+{
+    ratio->den = range(state, 10000000, 66000000);
+    ratio->num = range(state, 15 * ratio->den, 90 * ratio->den);
+}
+
+/* output MS from a fractional PLL, as in the exact planner */
+static void pll_ratio(uint64_t *state, struct ratio *ratio)
+{
+    uint64_t c = range(state, 1, MAX_DENOMINATOR);
+    uint64_t fb = range(state, 15, 89) * c + range(state, 0, c - 1);
+    uint64_t xtal = range(state, 10000000, 50000000);
+    ratio->num = xtal * fb;
+    ratio->den = c * range(state, xtal * fb / c / 900 + 1, xtal * fb / c / 4);
+}
+
+/* a few units away from an integer */
+static void near_integer_ratio(uint64_t *state, struct ratio *ratio)
+{
+    ratio->den = range(state, 1ull << 20, 1ull << 40);
+    uint64_t offset = range(state, 1, 3);
+    ratio->num = range(state, 5, 899) * ratio->den;
+    ratio->num = xorshift64(state) % 2 ? ratio->num + offset : ratio->num - offset;
+}
+
+/* a few units away from a fraction with a small denominator */
+static void near_fraction_ratio(uint64_t *state, struct ratio *ratio)
+{
+    uint64_t q = range(state, 2, 1000);
+    uint64_t p = range(state, 1, q - 1);
+    uint64_t scale = range(state, 1ull << 16, 1ull << 30);
+    ratio->den = q * scale;
+    ratio->num = (range(state, 4, 899) * q + p) * scale;
+    uint64_t offset = range(state, 1, 3);
+    ratio->num = xorshift64(state) % 2 ? ratio->num + offset : ratio->num - offset;
+}
+
+/* half way between two neighbours in the Farey sequence of order
+ * MAX_DENOMINATOR: two candidates at the same distance
+ */
+static void farey_midpoint_ratio(uint64_t *state, struct ratio *ratio)
+{
+    uint64_t q1, p1;
+    do {
+        q1 = range(state, MAX_DENOMINATOR / 2, MAX_DENOMINATOR);
+        p1 = range(state, 1, q1 - 1);
+    } while (gcd(p1, q1) != 1);
+    /* right neighbour: p2 q1 - p1 q2 = 1 with the largest q2 in range */
+    uint64_t q2 = (q1 - inverse(p1, q1)) % q1;
+    q2 += (MAX_DENOMINATOR - q2) / q1 * q1;
+    uint64_t p2 = (1 + p1 * q2) / q1;
+    ratio->den = 2 * q1 * q2;
+    ratio->num = range(state, 4, 899) * ratio->den + p1 * q2 + p2 * q1;
+}
+
+/* quotients of consecutive Fibonacci numbers: all the terms are 1 */
+static void fibonacci_ratio(uint64_t *state, struct ratio *ratio)
+{
+    uint64_t f0 = 1, f1 = 1;
+    int n = (int)range(state, 10, 70);
+    for (int i = 0; i < n; i++) {
+        uint64_t f = f0 + f1;
+        f0 = f1;
+        f1 = f;
+    }
+    ratio->den = f1;
+    ratio->num = range(state, 4, 899) * f1 + f0;
+}
+
+/* anything with a 48 bit denominator */
+static void random_ratio(uint64_t *state, struct ratio *ratio)
+{
+    ratio->den = range(state, 1, 1ull << 48);
+    ratio->num = range(state, 4, 899) * ratio->den + xorshift64(state) % ratio->den;
+}
+
+static void (*const ratio_kinds[])(uint64_t *state, struct ratio *ratio) = {
+    output_ratio,
+    feedback_ratio,
+    pll_ratio,
+    near_integer_ratio,
+    near_fraction_ratio,
+    farey_midpoint_ratio,
+    fibonacci_ratio,
+    random_ratio,
+};
+#define NKINDS (sizeof(ratio_kinds) / sizeof(ratio_kinds[0]))
+
+static void make_ratio(uint64_t index, struct ratio *ratio)
+{
+    uint64_t state = 0x5351 + index * 0x9e3779b97f4a7c15ull;
+    xorshift64(&state);
+    ratio_kinds[index % NKINDS](&state, ratio);
+}
+
+/* brute force: the nearest p/q for every q, the closest of them all (the
+ * smallest q on ties); n q mod den is updated incrementally
+ */
+static void oracle(const struct ratio *ratio, struct si5351_ms *ms)
+{
+    uint64_t den = ratio->den;
+    uint64_t n = ratio->num % den;
+    uint64_t best_m = n < den - n ? n : den - n;    /* distance * den * q */
+    uint64_t best_p = n < den - n ? 0 : 1;
+    uint64_t best_q = 1;
+    uint64_t r = n;
+    uint64_t p = 0;
+    for (uint64_t q = 2; q <= MAX_DENOMINATOR; q++) {
+        r += n;
+        if (r >= den) {
+            r -= den;
+            p++;
+        }
+        uint64_t m = r < den - r ? r : den - r;
+        if ((u128)m * best_q < (u128)best_m * q) {
+            best_m = m;
+            best_p = r < den - r ? p : p + 1;
+            best_q = q;
+        }
+    }
+
+    ms->a = (uint32_t)(ratio->num / den);
+    ms->b = (uint32_t)best_p;
+    ms->c = (uint32_t)best_q;
+    if (ms->b == ms->c) {
+        ms->a += 1;
+        ms->b = 0;
+        ms->c = 1;
+    }
+}
+
+/* |num / den - ms| den c */
+static u128 distance(const struct ratio *ratio, const struct si5351_ms *ms)
+{
+    u128 x = (u128)ratio->num * ms->c;
+    u128 y = (u128)ratio->den * ((uint64_t)ms->a * ms->c + ms->b);
+    return x > y ? x - y : y - x;
+}
+
+
+struct solver {
+    const char *name;
+    int exact;                  /* mismatches are failures */
+    void (*approximate)(const struct ratio *ratio, struct si5351_cache *cache,
+                        struct si5351_ms *ms);
+};
+
+static void exact_solver(const struct ratio *ratio, struct si5351_cache *cache,
+                         struct si5351_ms *ms)
+{
+    (void)cache;
+    si5351_rational_approximation_exact(ratio->num, ratio->den, MAX_DENOMINATOR, &ms->a, &ms->b, &ms->c);
+}
+
+static void cache_solver(const struct ratio *ratio, struct si5351_cache *cache,
+                         struct si5351_ms *ms)
+{
+    si5351_cache_approximation(cache, ratio->num, ratio->den, MAX_DENOMINATOR, &ms->a, &ms->b, &ms->c);
+}
+
+static void embedded_solver(const struct ratio *ratio, struct si5351_cache *cache,
+                            struct si5351_ms *ms)
+{
+    (void)cache;
+    si5351e_approximate(ratio->num, ratio->den, ms);
+}
+
+static void double_solver(const struct ratio *ratio, struct si5351_cache *cache,
+                          struct si5351_ms *ms)
+{
+    (void)cache;
+    si5351_rational_approximation((double)ratio->num / (double)ratio->den, MAX_DENOMINATOR, &ms->a, &ms->b, &ms->c);
+}
+
+static const struct solver solvers[] = {
+    {"exact", 1, exact_solver},
+    {"cache", 1, cache_solver},
+    {"embedded", 1, embedded_solver},
+    {"double", 0, double_solver},
+};
+#define NSOLVERS (sizeof(solvers) / sizeof(solvers[0]))
+
+struct solver_totals {
+    uint64_t mismatches;
+    uint64_t ties;
+    double seconds;
+};
+
+struct validate_worker {
+    uint64_t first;             /* ratios first, first + step, ... < count */
+    uint64_t step;
+    uint64_t count;
+    pthread_mutex_t *report_lock;
+    int *reported;              /* per solver, shared */
+    double oracle_seconds;
+    struct solver_totals totals[NSOLVERS];
+};
+
+/* the solvers are timed over BLOCK ratios at a time, so the clock is not
+ * read around every call; CPU time of the thread, so that ns/call does
+ * not depend on -j
+ */
+#define BLOCK 64
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *validate_worker(void *arg)
+{
+    struct validate_worker *worker = arg;
+    struct si5351_cache cache;
+    if (si5351_cache_init(&cache, CACHE_SIZE) != SI5351_OK) {
+        fprintf(stderr, "cannot allocate the cache\n");
+        exit(EXIT_FAILURE);
+    }
+
+    struct ratio ratios[BLOCK];
+    struct si5351_ms expected[BLOCK];
+    struct si5351_ms results[BLOCK];
+    uint64_t index = worker->first;
+    while (index < worker->count) {
+        int n = 0;
+        for (; n < BLOCK && index < worker->count; n++, index += worker->step)
+            make_ratio(index, &ratios[n]);
+
+        double start = now();
+        for (int i = 0; i < n; i++)
+            oracle(&ratios[i], &expected[i]);
+        worker->oracle_seconds += now() - start;
+
+        for (size_t s = 0; s < NSOLVERS; s++) {
+            const struct solver *solver = &solvers[s];
+            struct solver_totals *totals = &worker->totals[s];
+            start = now();
+            for (int i = 0; i < n; i++)
+                solver->approximate(&ratios[i], &cache, &results[i]);
+            totals->seconds += now() - start;
+
+            for (int i = 0; i < n; i++) {
+                const struct si5351_ms *ms = &results[i];
+                const struct si5351_ms *best = &expected[i];
+                if (ms->a == best->a && ms->b == best->b && ms->c == best->c)
+                    continue;
+                int valid = ms->c >= 1 && ms->c <= MAX_DENOMINATOR && ms->b <= ms->c;
+                /* distance(ms) / c vs distance(best) / best->c */
+                u128 d = valid ? distance(&ratios[i], ms) : 0;
+                u128 d_best = distance(&ratios[i], best);
+                if (valid && d * best->c == d_best * ms->c) {
+                    totals->ties++;
+                    continue;
+                }
+                if (valid && d * best->c < d_best * ms->c) {
+                    fprintf(stderr, "%s: %llu/%llu: oracle %u %u %u is not the best\n", solver->name, (unsigned long long)ratios[i].num, (unsigned long long)ratios[i].den, best->a, best->b, best->c);
+                    exit(EXIT_FAILURE);
+                }
+                totals->mismatches++;
+                pthread_mutex_lock(worker->report_lock);
+                if (worker->reported[s]++ < MAX_REPORTED)
+                    fprintf(stderr, "%s: %llu/%llu: %u %u %u, expected %u %u %u\n", solver->name, (unsigned long long)ratios[i].num, (unsigned long long)ratios[i].den, ms->a, ms->b, ms->c, best->a, best->b, best->c);
+                pthread_mutex_unlock(worker->report_lock);
+            }
+        }
+    }
+    si5351_cache_free(&cache);
+    return NULL;
+}
+
+/* planner candidates: a fractional clock is valid exactly when its output
+ * MS ratio is in the 4-900 range (the ratios within RATIO_MARGIN of a
+ * limit may approximate either way and are not checked); the search
+ * reuses one candidate, so a flag left over from an earlier candidate
+ * shows up here
+ */
+static const double RATIO_MARGIN = 1e-6;
+
+static const struct si5351_plan_request plan_checks[] = {
+    {25000000, 3, {3579545, 1000000, 33333333}},
+    {25000000, 2, {4687500, 66672000}},
+    {27000000, 3, {10000000, 66672000, 1000000}},
+    {25000000, 4, {1000000, 140000000, 1000000, 5000000}},
+};
+#define NPLAN_CHECKS (sizeof(plan_checks) / sizeof(plan_checks[0]))
+
+struct candidate_check {
+    uint64_t candidates;
+    uint64_t mismatches;
+};
+
+static void check_candidate(const struct si5351_plan_result *candidate, void *arg)
+{
+    struct candidate_check *check = arg;
+    /* the clocks of a rejected candidate are not evaluated */
+    if (candidate->status != SI5351_OK)
+        return;
+    check->candidates++;
+    /* MS6 and MS7 are even integers only */
+    for (int nclk = 1; nclk < candidate->nclks && nclk < 6; nclk++) {
+        double ratio = candidate->pll_freq[candidate->pll[nclk]] / candidate->clks[nclk];
+        if (fabs(ratio - 4) < RATIO_MARGIN || fabs(ratio - 900) < RATIO_MARGIN)
+            continue;
+        int valid = ratio >= 4 && ratio <= 900;
+        if (candidate->valid[nclk] == valid)
+            continue;
+        check->mismatches++;
+        if (check->mismatches <= (uint64_t)MAX_REPORTED)
+            fprintf(stderr, "candidates: scenario %d f_pll %.0f clock %d: valid %d, expected %d\n", candidate->scenario, candidate->pll_freq[candidate->pll[nclk]], nclk, candidate->valid[nclk], valid);
+    }
+}
+
+static void check_plans(struct candidate_check *check)
+{
+    for (size_t i = 0; i < NPLAN_CHECKS; i++) {
+        const struct si5351_plan_request *request = &plan_checks[i];
+        struct si5351_setup setup = {0};
+        if (si5351_setup(&setup, request->xtal, request->clks[0]) != SI5351_OK)
+            continue;
+        si5351_plan_scenario1(&setup, request, check_candidate, check);
+        si5351_plan_scenario2(&setup, request, check_candidate, check);
+    }
+}
+
+/* optimizer plans with MS6/MS7 clocks at the frequency of a lower clock:
+ * every output MS is checked against the hardware ranges (even integer
+ * 6-254 for MS6 and MS7; 4, 6 or 8-900 for MS0-MS5) and the R divider
+ * against 0-7
+ */
+static const struct si5351_plan_request optimize_checks[] = {
+    {25000000, 8, {10000000, 1500000, 10000000, 10000000, 10000000, 10000000, 10000000, 1500000}},
+    {25000000, 8, {10000000, 1500000, 10000000, 10000000, 10000000, 10000000, 10000000, 10000000}},
+    {25000000, 7, {7074000, 14074000, 7074000, 3500000, 3500000, 3500000, 14074000}},
+};
+#define NOPTIMIZE_CHECKS (sizeof(optimize_checks) / sizeof(optimize_checks[0]))
+#define OPTIMIZE_TOP_K 8
+
+static int valid_output(int nclk, const struct si5351_ms *ms)
+{
+    if (nclk >= 6)
+        return ms->b == 0 && ms->a % 2 == 0 && ms->a >= 6 && ms->a <= 254;
+    if (ms->a < 8)
+        return ms->b == 0 && (ms->a == 4 || ms->a == 6);
+    return ms->c >= 1 && ms->b < ms->c && (ms->a < 900 || (ms->a == 900 && ms->b == 0));
+}
+
+static uint64_t check_optimize(uint64_t *plans)
+{
+    struct si5351_optimize_options options;
+    si5351_optimize_defaults(&options);
+    options.top_k = OPTIMIZE_TOP_K;
+    uint64_t mismatches = 0;
+    *plans = 0;
+    for (size_t i = 0; i < NOPTIMIZE_CHECKS; i++) {
+        const struct si5351_plan_request *request = &optimize_checks[i];
+        struct si5351_setup setup = {0};
+        struct si5351_plan_result results[OPTIMIZE_TOP_K];
+        int n = si5351_optimize(&setup, request, &options, results);
+        for (int k = 0; k < n; k++) {
+            (*plans)++;
+            for (int nclk = 0; nclk < request->nclks; nclk++) {
+                const struct si5351_ms *ms = &results[k].output[nclk];
+                if (valid_output(nclk, ms) && results[k].rdiv[nclk] <= 7)
+                    continue;
+                mismatches++;
+                fprintf(stderr, "optimizer: request %zu plan %d clock %d: MS %u %u %u rdiv %d\n", i, k, nclk, ms->a, ms->b, ms->c, results[k].rdiv[nclk]);
+            }
+        }
+    }
+    return mismatches;
+}
+
+/* si5351_plan() for clocks that need an R divider, down to where R = 128
+ * is no longer enough: the plans get the same output MS and R divider
+ * checks as the optimizer ones
+ */
+static const double low_clock_checks[] = {
+    5000, 7812, 7813, 7900, 8000, 9000, 15625, 100000, 500000, 999999,
+};
+#define NLOW_CLOCK_CHECKS (sizeof(low_clock_checks) / sizeof(low_clock_checks[0]))
+
+static uint64_t check_low_clocks(uint64_t *plans)
+{
+    uint64_t mismatches = 0;
+    *plans = 0;
+    for (size_t i = 0; i < NLOW_CLOCK_CHECKS; i++) {
+        struct si5351_plan_request request = {25000000, 1, {low_clock_checks[i]}};
+        struct si5351_setup setup = {0};
+        struct si5351_plan_result plan;
+        if (si5351_plan(&setup, &request, &plan) != SI5351_OK)
+            continue;
+        (*plans)++;
+        if (valid_output(0, &plan.output[0]) && plan.rdiv[0] <= 7)
+            continue;
+        mismatches++;
+        fprintf(stderr, "low clock: %.0f: MS %u %u %u rdiv %d\n", request.clks[0], plan.output[0].a, plan.output[0].b, plan.output[0].c, plan.rdiv[0]);
+    }
+    return mismatches;
+}
+
+/* out of range xtal and clock 0 values as the first request of a
+ * zero-initialized setup and after a valid one: the status must not depend
+ * on what the setup saw before
+ */
+struct setup_check {
+    double xtal;
+    double clk0;
+    int status;
+};
+
+static const struct setup_check setup_checks[] = {
+    {0, 10000000, SI5351_ERR_XTAL_RANGE},
+    {25000000, 0, SI5351_ERR_CLOCK_LOW},
+    {0, 0, SI5351_ERR_XTAL_RANGE},
+    {5000000, 10000000, SI5351_ERR_XTAL_RANGE},
+    {25000000, 5000, SI5351_ERR_CLOCK_LOW},
+};
+#define NSETUP_CHECKS (sizeof(setup_checks) / sizeof(setup_checks[0]))
+
+static uint64_t check_setup(void)
+{
+    uint64_t mismatches = 0;
+    for (size_t i = 0; i < NSETUP_CHECKS; i++) {
+        const struct setup_check *check = &setup_checks[i];
+        struct si5351_plan_request request = {check->xtal, 1, {check->clk0}};
+        for (int previous = 0; previous < 2; previous++) {
+            struct si5351_setup setup = {0};
+            struct si5351_plan_result plan;
+            if (previous)
+                si5351_setup(&setup, 25000000, 10000000);
+            int status = si5351_plan(&setup, &request, &plan);
+            if (status == check->status)
+                continue;
+            mismatches++;
+            fprintf(stderr, "setup: xtal %.0f clock 0 %.0f%s: status %d, expected %d\n", check->xtal, check->clk0, previous ? " (after a valid request)" : "", status, check->status);
+        }
+    }
+    return mismatches;
+}
+
+/* si5351_fine_tune() corrections of up to +/-500Hz around clocks from MS
+ * 8 (120MHz) to a 7MHz one: the error must be within
+ * SI5351_FINE_TUNE_MAX_PPB or no larger than that of the best rational
+ * approximation, and never above the grid bound 1/2097150 of the MS
+ */
+static const double fine_tune_checks[] = {100000000, 120000000, 50000000, 7074000};
+#define NFINE_TUNE_CHECKS (sizeof(fine_tune_checks) / sizeof(fine_tune_checks[0]))
+#define FINE_TUNE_STEPS 1001
+
+static uint64_t check_fine_tune(uint64_t *corrections)
+{
+    uint64_t mismatches = 0;
+    *corrections = 0;
+    for (size_t i = 0; i < NFINE_TUNE_CHECKS; i++) {
+        struct si5351_plan_request request = {25000000, 1, {fine_tune_checks[i]}};
+        struct si5351_setup setup = {0};
+        struct si5351_plan_result plan;
+        struct si5351_fine_tune tune;
+        if (si5351_plan(&setup, &request, &plan) != SI5351_OK ||
+            si5351_fine_tune_init(&tune, &plan, request.xtal, 0) != SI5351_OK) {
+            mismatches++;
+            fprintf(stderr, "fine tune: %.0f: no plan to tune\n", request.clks[0]);
+            continue;
+        }
+        for (int step = 0; step < FINE_TUNE_STEPS; step++) {
+            double clk = request.clks[0] + step - FINE_TUNE_STEPS / 2;
+            if (si5351_fine_tune(&tune, clk, &plan) != SI5351_OK)
+                continue;
+            (*corrections)++;
+            /* output MS errors relative to the exact MS pll_num / den */
+            uint64_t den = tune.pll_den * ((uint64_t)clk << plan.rdiv[0]);
+            double exact = (double)tune.pll_num / (double)den;
+            struct si5351_ms best;
+            si5351_rational_approximation_exact(tune.pll_num, den, MAX_DENOMINATOR, &best.a, &best.b, &best.c);
+            const struct si5351_ms *ms = &plan.output[0];
+            double ppb = fabs(ms->a + (double)ms->b / ms->c - exact) / exact * 1e9;
+            double best_ppb = fabs(best.a + (double)best.b / best.c - exact) / exact * 1e9;
+            double grid_ppb = 1e9 / (2.0 * MAX_DENOMINATOR * exact);
+            /* with some room for the double arithmetic */
+            double bound = fmax(SI5351_FINE_TUNE_MAX_PPB, best_ppb);
+            if (ppb <= bound * (1 + 1e-6) + 1e-6 && ppb <= grid_ppb * (1 + 1e-6) + 1e-6)
+                continue;
+            mismatches++;
+            if (mismatches <= (uint64_t)MAX_REPORTED)
+                fprintf(stderr, "fine tune: %.0f: MS %u %u %u, %.1fppb (best %.1fppb, grid bound %.1fppb)\n", clk, ms->a, ms->b, ms->c, ppb, best_ppb, grid_ppb);
+        }
+    }
+    return mismatches;
+}
+
+/* the CLKIN_DIV of the embedded planner against si5351_setup(), around
+ * the 40MHz and 80MHz boundaries
+ */
+static const uint32_t clkin_div_checks[] = {
+    10000000, 25000000, 39999999, 40000000, 40000001,
+    79999999, 80000000, 80000001, 99999999, 100000000,
+};
+#define NCLKIN_DIV_CHECKS (sizeof(clkin_div_checks) / sizeof(clkin_div_checks[0]))
+
+static uint64_t check_clkin_div(void)
+{
+    uint64_t mismatches = 0;
+    for (size_t i = 0; i < NCLKIN_DIV_CHECKS; i++) {
+        uint32_t xtal = clkin_div_checks[i];
+        struct si5351_setup setup = {0};
+        struct si5351e_plan plan;
+        int status = si5351_setup(&setup, xtal, 10000000);
+        int embedded_status = si5351e_plan(xtal, 10000000, &plan);
+        if (status == SI5351_OK && embedded_status == SI5351_OK &&
+            plan.clkin_div == setup.clkin_div && SI5351E_CLKIN_DIV(xtal) == setup.clkin_div)
+            continue;
+        mismatches++;
+        fprintf(stderr, "clkin_div: xtal %u: embedded %d (status %d), library %d (status %d)\n", xtal, plan.clkin_div, embedded_status, setup.clkin_div, status);
+    }
+    return mismatches;
+}
+
+int main(int argc, char **argv)
+{
+    long njobs = sysconf(_SC_NPROCESSORS_ONLN);
+    uint64_t count = 20000;
+    int opt;
+    while ((opt = getopt(argc, argv, "j:")) != -1) {
+        switch (opt) {
+        case 'j':
+            njobs = atol(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-j N] [ratios]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind < argc)
+        count = strtoull(argv[optind], NULL, 0);
+    if (njobs < 1 || optind + 1 < argc || count == 0) {
+        fprintf(stderr, "usage: %s [-j N] [ratios]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    struct validate_worker *workers = calloc(njobs, sizeof(*workers));
+    pthread_t *threads = calloc(njobs, sizeof(*threads));
+    if (workers == NULL || threads == NULL) {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
+    pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+    int reported[NSOLVERS] = {0};
+    for (long j = 0; j < njobs; j++) {
+        workers[j].first = (uint64_t)j;
+        workers[j].step = (uint64_t)njobs;
+        workers[j].count = count;
+        workers[j].report_lock = &report_lock;
+        workers[j].reported = reported;
+        int error = pthread_create(&threads[j], NULL, validate_worker, &workers[j]);
+        if (error != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(error));
+            return EXIT_FAILURE;
+        }
+    }
+
+    double oracle_seconds = 0;
+    struct solver_totals totals[NSOLVERS];
+    memset(totals, 0, sizeof(totals));
+    for (long j = 0; j < njobs; j++) {
+        pthread_join(threads[j], NULL);
+        oracle_seconds += workers[j].oracle_seconds;
+        for (size_t s = 0; s < NSOLVERS; s++) {
+            totals[s].mismatches += workers[j].totals[s].mismatches;
+            totals[s].ties += workers[j].totals[s].ties;
+            totals[s].seconds += workers[j].totals[s].seconds;
+        }
+    }
+
+    int status = EXIT_SUCCESS;
+    fprintf(stdout, "oracle %llu 0 0 %.1f 1.0\n", (unsigned long long)count, oracle_seconds * 1e9 / count);
+    for (size_t s = 0; s < NSOLVERS; s++) {
+        const struct solver_totals *t = &totals[s];
+        fprintf(stdout, "%s %llu %llu %llu %.1f %.0f\n", solvers[s].name, (unsigned long long)count, (unsigned long long)t->mismatches, (unsigned long long)t->ties, t->seconds * 1e9 / count, oracle_seconds / t->seconds);
+        if (solvers[s].exact && t->mismatches > 0)
+            status = EXIT_FAILURE;
+    }
+
+    struct candidate_check check = {0};
+    check_plans(&check);
+    fprintf(stdout, "candidates %llu %llu\n", (unsigned long long)check.candidates, (unsigned long long)check.mismatches);
+    if (check.mismatches > 0)
+        status = EXIT_FAILURE;
+    uint64_t optimize_plans;
+    uint64_t optimize_mismatches = check_optimize(&optimize_plans);
+    fprintf(stdout, "optimizer %llu %llu\n", (unsigned long long)optimize_plans, (unsigned long long)optimize_mismatches);
+    if (optimize_mismatches > 0)
+        status = EXIT_FAILURE;
+    uint64_t low_plans;
+    uint64_t low_mismatches = check_low_clocks(&low_plans);
+    fprintf(stdout, "low_clocks %llu %llu\n", (unsigned long long)low_plans, (unsigned long long)low_mismatches);
+    if (low_mismatches > 0)
+        status = EXIT_FAILURE;
+    uint64_t setup_mismatches = check_setup();
+    fprintf(stdout, "setup %llu %llu\n", (unsigned long long)(2 * NSETUP_CHECKS), (unsigned long long)setup_mismatches);
+    if (setup_mismatches > 0)
+        status = EXIT_FAILURE;
+    uint64_t corrections;
+    uint64_t fine_tune_mismatches = check_fine_tune(&corrections);
+    fprintf(stdout, "fine_tune %llu %llu\n", (unsigned long long)corrections, (unsigned long long)fine_tune_mismatches);
+    if (fine_tune_mismatches > 0)
+        status = EXIT_FAILURE;
+    uint64_t clkin_div_mismatches = check_clkin_div();
+    fprintf(stdout, "clkin_div %llu %llu\n", (unsigned long long)NCLKIN_DIV_CHECKS, (unsigned long long)clkin_div_mismatches);
+    if (clkin_div_mismatches > 0)
+        status = EXIT_FAILURE;
+
+    free(threads);
+    free(workers);
+    return status;
+}
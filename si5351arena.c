@@ -0,0 +1,39 @@
+/* Si5351 frequency planning library - caller provided scratch memory
+ *
+ * Copyright 2024, Franco Venturi, K4VZ
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "si5351plan.h"
+#include "si5351internal.h"
+
+/* one buffer per thread, sized once: the planners that need scratch
+ * memory take it from the top and reset used back on return, so a
+ * request costs no heap allocations and the threads share no allocator
+ */
+
+void si5351_arena_init(struct si5351_arena *arena, void *buffer, size_t size)
+{
+    arena->base = buffer;
+    arena->size = size;
+    /* the first allocation starts on an aligned address */
+    size_t skip = (SI5351_ARENA_ALIGN - (uintptr_t)buffer % SI5351_ARENA_ALIGN) % SI5351_ARENA_ALIGN;
+    arena->used = skip < size ? skip : size;
+    arena->peak = arena->used;
+}
+
+void *si5351_arena_alloc(struct si5351_arena *arena, size_t size)
+{
+    size_t rounded = (size + SI5351_ARENA_ALIGN - 1) & ~(SI5351_ARENA_ALIGN - 1);
+    if (rounded < size || rounded > arena->size - arena->used)
+        return NULL;
+    void *p = arena->base + arena->used;
+    arena->used += rounded;
+    if (arena->used > arena->peak)
+        arena->peak = arena->used;
+    return p;
+}
@@ -0,0 +1,83 @@
+/* Si5351 frequency planning library - rational approximation cache
+ *
+ * Copyright 2024, Franco Venturi, K4VZ
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "si5351plan.h"
+#include "si5351internal.h"
+
+/* direct mapped: a new entry simply replaces the one in its slot */
+
+static uint32_t cache_entries(uint32_t size)
+{
+    uint32_t nentries = 1;
+    while (nentries < size && nentries < (UINT32_C(1) << 31))
+        nentries <<= 1;
+    return nentries;
+}
+
+int si5351_cache_init(struct si5351_cache *cache, uint32_t size)
+{
+    uint32_t nentries = cache_entries(size);
+    cache->entries = calloc(nentries, sizeof(*cache->entries));
+    if (cache->entries == NULL)
+        return SI5351_ERR_NOMEM;
+    cache->mask = nentries - 1;
+    cache->hits = 0;
+    cache->misses = 0;
+    return SI5351_OK;
+}
+
+size_t si5351_cache_arena_size(uint32_t size)
+{
+    return (size_t)cache_entries(size) * sizeof(struct si5351_cache_entry) + SI5351_ARENA_ALIGN;
+}
+
+int si5351_cache_init_arena(struct si5351_cache *cache, struct si5351_arena *arena,
+                            uint32_t size)
+{
+    uint32_t nentries = cache_entries(size);
+    cache->entries = si5351_arena_alloc(arena, (size_t)nentries * sizeof(*cache->entries));
+    if (cache->entries == NULL)
+        return SI5351_ERR_NOMEM;
+    memset(cache->entries, 0, nentries * sizeof(*cache->entries));
+    cache->mask = nentries - 1;
+    cache->hits = 0;
+    cache->misses = 0;
+    return SI5351_OK;
+}
+
+void si5351_cache_free(struct si5351_cache *cache)
+{
+    free(cache->entries);
+    cache->entries = NULL;
+}
+
+void si5351_cache_approximation(struct si5351_cache *cache,
+                                uint64_t num, uint64_t den,
+                                uint32_t max_denominator,
+                                uint32_t *a, uint32_t *b, uint32_t *c)
+{
+    uint64_t h = num * UINT64_C(0x9e3779b97f4a7c15) ^ den * UINT64_C(0xc2b2ae3d27d4eb4f) ^ max_denominator;
+    h ^= h >> 29;
+    struct si5351_cache_entry *entry = &cache->entries[h & cache->mask];
+
+    if (entry->num == num && entry->den == den && entry->max_denominator == max_denominator) {
+        cache->hits++;
+    } else {
+        cache->misses++;
+        entry->num = num;
+        entry->den = den;
+        entry->max_denominator = max_denominator;
+        si5351_rational_approximation_exact(num, den, max_denominator, &entry->ms.a, &entry->ms.b, &entry->ms.c);
+    }
+    *a = entry->ms.a;
+    *b = entry->ms.b;
+    *c = entry->ms.c;
+}
@@ -0,0 +1,85 @@
+/* Si5351 frequency planning library - xtal calibration
+ *
+ * Copyright 2024, Franco Venturi, K4VZ
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <math.h>
+#include <stdint.h>
+
+#include "si5351plan.h"
+#include "si5351internal.h"
+
+/* a correction of a few ppm moves the VCO of a plan by a few kHz: keeping
+ * the VCO and the output MS where the full search put them and solving
+ * the feedback MS again is one rational approximation per PLL, and the
+ * clocks end up where they were before the correction (to within the
+ * feedback MS approximation, far below 1ppb)
+ */
+
+double si5351_calibration_ppb(const struct si5351_calibration *calibration, double temp)
+{
+    int n = calibration->npoints;
+    const double *t = calibration->temp;
+    const double *ppb = calibration->temp_ppb;
+    if (n == 0)
+        return calibration->ppb;
+    if (temp <= t[0])
+        return calibration->ppb + ppb[0];
+    if (temp >= t[n - 1])
+        return calibration->ppb + ppb[n - 1];
+    int i = 1;
+    while (t[i] < temp)
+        i++;
+    double x = (temp - t[i - 1]) / (t[i] - t[i - 1]);
+    return calibration->ppb + ppb[i - 1] + x * (ppb[i] - ppb[i - 1]);
+}
+
+double si5351_calibrated_xtal(const struct si5351_calibration *calibration,
+                              double xtal, double temp)
+{
+    return xtal * (1 + si5351_calibration_ppb(calibration, temp) / 1e9);
+}
+
+int si5351_recalibrate(const struct si5351_plan_result *previous, double xtal,
+                       struct si5351_plan_result *plan)
+{
+    if (xtal < SI5351_MIN_CLKIN_FREQ || xtal > SI5351_MAX_CLKIN_FREQ)
+        return SI5351_ERR_XTAL_RANGE;
+    double clkin = xtal / (1 << previous->clkin_div);
+    if (clkin > 40e6)
+        return SI5351_ERR_XTAL_RANGE;
+
+    *plan = *previous;
+    for (int pll = SI5351_PLLA; pll <= SI5351_PLLB; pll++) {
+        struct si5351_ms *fb = &plan->feedback[pll];
+        if (plan->pll_freq[pll] == 0)
+            continue;
+        si5351_rational_approximation(previous->pll_freq[pll] / clkin, SI5351_MAX_DENOMINATOR,
+                                      &fb->a, &fb->b, &fb->c);
+        if (!si5351_valid_feedback_ms(fb))
+            return SI5351_ERR_FEEDBACK_MS;
+        plan->pll_freq[pll] = clkin * si5351_ms_value(fb);
+        if (plan->pll_freq[pll] < SI5351_MIN_VCO_FREQ || plan->pll_freq[pll] > SI5351_MAX_VCO_FREQ)
+            return SI5351_ERR_FEEDBACK_MS;
+    }
+
+    plan->max_clk_diff = 0;
+    plan->max_ppb = 0;
+    for (int nclk = 0; nclk < plan->nclks; nclk++) {
+        if (!plan->valid[nclk])
+            continue;
+        double clk = plan->clks[nclk];
+        double clk_diff = si5351_clock_diff(0, clk, plan->rdiv[nclk], plan->pll_freq[plan->pll[nclk]],
+                                            0, 0, &plan->output[nclk]);
+        plan->actual[nclk] = clk + clk_diff;
+        plan->clk_diff[nclk] = clk_diff;
+        plan->max_clk_diff = fmax(plan->max_clk_diff, fabs(clk_diff));
+        plan->max_ppb = fmax(plan->max_ppb, fabs(clk_diff) / clk * 1e9);
+    }
+    /* the MultiSynth penalties stay the same */
+    plan->cost = previous->cost - previous->max_ppb + plan->max_ppb;
+    si5351_plan_quality(plan, &plan->quality);
+    return SI5351_OK;
+}
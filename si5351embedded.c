@@ -0,0 +1,134 @@
+/* Si5351 frequency planning - freestanding integer only planner
+ *
+ * Copyright 2024, Franco Venturi, K4VZ
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <stdint.h>
+
+#include "si5351embedded.h"
+
+/* no <math.h>, no 128 bit integers (not available on 32 bit ARM): the
+ * wide products of the semiconvergent test are done on 32 bit limbs
+ */
+
+/* x y < u v */
+static int product_less(uint64_t x, uint64_t y, uint64_t u, uint64_t v)
+{
+    uint64_t p[2][2];           /* {hi, lo} of x y and u v */
+    uint64_t f[2][2] = {{x, y}, {u, v}};
+    for (int i = 0; i < 2; i++) {
+        uint64_t a0 = f[i][0] & 0xffffffff;
+        uint64_t a1 = f[i][0] >> 32;
+        uint64_t b0 = f[i][1] & 0xffffffff;
+        uint64_t b1 = f[i][1] >> 32;
+        uint64_t p00 = a0 * b0;
+        uint64_t p01 = a0 * b1;
+        uint64_t p10 = a1 * b0;
+        uint64_t mid = (p00 >> 32) + (p01 & 0xffffffff) + (p10 & 0xffffffff);
+        p[i][0] = a1 * b1 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+        p[i][1] = (mid << 32) | (p00 & 0xffffffff);
+    }
+    return p[0][0] < p[1][0] || (p[0][0] == p[1][0] && p[0][1] < p[1][1]);
+}
+
+/* same algorithm as si5351_rational_approximation_exact() */
+void si5351e_approximate(uint64_t num, uint64_t den, struct si5351_ms *ms)
+{
+    const uint64_t max_denominator = SI5351E_MAX_DENOMINATOR;
+    uint32_t a = (uint32_t)(num / den);
+    uint64_t n = num % den;
+    uint64_t d = den;
+
+    uint64_t h[] = {0, 1};
+    uint64_t k[] = {1, 0};
+    for (int i = 0; i < SI5351E_MAX_TERMS && d != 0; i++) {
+        uint64_t an = n / d;
+        uint64_t kn = an * k[1] + k[0];
+        if (kn > max_denominator)
+            break;
+        uint64_t hn = an * h[1] + h[0];
+        h[0] = h[1]; h[1] = hn;
+        k[0] = k[1]; k[1] = kn;
+        uint64_t r = n - an * d;
+        n = d;
+        d = r;
+    }
+
+    if (d != 0) {
+        uint64_t m = (max_denominator - k[0]) / k[1];
+        if (product_less(n, k[1], d, k[0] + 2 * m * k[1])) {
+            h[1] = h[0] + m * h[1];
+            k[1] = k[0] + m * k[1];
+        }
+    }
+
+    ms->a = a;
+    ms->b = (uint32_t)h[1];
+    ms->c = (uint32_t)k[1];
+    if (ms->b == ms->c) {
+        ms->a += 1;
+        ms->b = 0;
+        ms->c = 1;
+    }
+}
+
+int si5351e_plan(uint32_t xtal, uint32_t clk, struct si5351e_plan *plan)
+{
+    return si5351e_plan_inline(xtal, clk, plan);
+}
+
+const struct si5351e_plan *si5351e_table_lookup(const struct si5351e_table *table,
+                                                uint32_t clk)
+{
+    if (clk < table->start)
+        return 0;
+    uint32_t i = (clk - table->start + table->step / 2) / table->step;
+    if (i >= table->count || table->plans[i].xtal == 0)
+        return 0;
+    return &table->plans[i];
+}
+
+int si5351e_output(const struct si5351e_plan *plan, uint32_t clk, struct si5351_ms *ms)
+{
+    const struct si5351_ms *fb = &plan->feedback;
+    if (clk < 1000000)
+        return SI5351_ERR_CLOCK_LOW;
+
+    /* vco / clk = xtal (a c + b) / (c 2^clkin_div clk) */
+    uint64_t num = (uint64_t)plan->xtal * ((uint64_t)fb->a * fb->c + fb->b);
+    uint64_t den = ((uint64_t)fb->c << plan->clkin_div) * clk;
+    if (num / den < 4 || num / den > 900)
+        return SI5351_ERR_OUTPUT_MS;
+    si5351e_approximate(num, den, ms);
+    /* 4, 6 and 8-900 in integer mode, 8-900 (exclusive) in fractional mode */
+    int valid = ms->b == 0 ? ms->a == 4 || ms->a == 6 || (ms->a >= 8 && ms->a <= 900) :
+                             ms->a >= 8 && ms->a < 900;
+    return valid ? SI5351_OK : SI5351_ERR_OUTPUT_MS;
+}
+
+void si5351e_encode(const struct si5351_ms *ms, uint8_t rdiv, uint8_t regs[8])
+{
+    uint32_t p1, p2, p3;
+    uint8_t divby4 = 0;
+    if (ms->a == 4 && ms->b == 0) {
+        p1 = 0;
+        p2 = 0;
+        p3 = 1;
+        divby4 = 0x0c;
+    } else {
+        uint32_t f = (uint32_t)(((uint64_t)128 * ms->b) / ms->c);
+        p1 = 128 * ms->a + f - 512;
+        p2 = 128 * ms->b - ms->c * f;
+        p3 = ms->c;
+    }
+    regs[0] = (p3 >> 8) & 0xff;
+    regs[1] = p3 & 0xff;
+    regs[2] = (uint8_t)((rdiv & 0x07) << 4) | divby4 | ((p1 >> 16) & 0x03);
+    regs[3] = (p1 >> 8) & 0xff;
+    regs[4] = p1 & 0xff;
+    regs[5] = ((p3 >> 12) & 0xf0) | ((p2 >> 16) & 0x0f);
+    regs[6] = (p2 >> 8) & 0xff;
+    regs[7] = p2 & 0xff;
+}
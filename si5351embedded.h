@@ -0,0 +1,148 @@
+/* Si5351 frequency planning - freestanding integer only planner
+ *
+ * Copyright 2024, Franco Venturi, K4VZ
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef SI5351EMBEDDED_H
+#define SI5351EMBEDDED_H
+
+#include <stdint.h>
+
+#include "si5351plan.h"
+
+/* for firmware: only needs <stdint.h> (no libc, no heap, no floating
+ * point) and every loop has a fixed bound, so the worst case can be
+ * measured once on the target:
+ *
+ *   si5351e_approximate()  at most SI5351E_MAX_TERMS continued fraction
+ *                          terms (one 64 bit division each)
+ *   si5351e_plan()         one approximation plus two loops of at most 3
+ *                          (CLKIN_DIV) and 7 (R divider) iterations
+ *   si5351e_output()       one approximation
+ *   si5351e_encode()       straight line code
+ *
+ * on 32 bit targets the 64 bit divisions come from libgcc/compiler-rt
+ * (__aeabi_uldivmod on ARM)
+ */
+
+/* the convergent denominators grow at least as fast as the Fibonacci
+ * numbers and F(31) > SI5351E_MAX_DENOMINATOR
+ */
+#define SI5351E_MAX_TERMS 32
+#define SI5351E_MAX_DENOMINATOR 1048575
+
+#define SI5351E_MIN_VCO_FREQ 600000000
+#define SI5351E_MAX_VCO_FREQ 1000000000
+#define SI5351E_MIN_CLKIN_FREQ 10000000
+#define SI5351E_MAX_CLKIN_FREQ 100000000
+
+/* CLKIN_DIV bringing xtal (10-100MHz) within 10-40MHz, as
+ * si5351_setup(); a constant expression for a constant xtal
+ */
+#define SI5351E_CLKIN_DIV(xtal) \
+    ((xtal) > 80000000 ? 2 : (xtal) > 40000000 ? 1 : 0)
+
+struct si5351e_plan {
+    uint32_t xtal;              /* CLKIN (Hz) */
+    uint8_t clkin_div;
+    uint8_t rdiv;
+    struct si5351_ms feedback;
+    struct si5351_ms output;    /* even integer from si5351e_plan() */
+};
+
+/* plans for clk = start + i * step, i < count (si5351-experiments
+ * --table-source generates them as const data); plans without a solution
+ * have xtal = 0
+ */
+struct si5351e_table {
+    uint32_t start;             /* Hz */
+    uint32_t step;              /* Hz */
+    uint32_t count;
+    const struct si5351e_plan *plans;
+};
+
+/* num / den ~= a + b / c with c <= SI5351E_MAX_DENOMINATOR: the same
+ * result as si5351_rational_approximation_exact() (den > 0, num / den < 2^32),
+ * i.e. what the library uses for integer Hz requests; it can differ from
+ * the double si5351_rational_approximation() where that one stops at its
+ * epsilon (fractions below 1e-5)
+ */
+void si5351e_approximate(uint64_t num, uint64_t den, struct si5351_ms *ms);
+
+/* clock 0 on PLLA with an even integer output MS and the highest VCO
+ * frequency up to 1000MHz (N-frac feedback MS, the first scenario);
+ * returns SI5351_OK or a negative enum si5351_status
+ */
+int si5351e_plan(uint32_t xtal, uint32_t clk, struct si5351e_plan *plan);
+
+/* plan of the grid point nearest to clk, NULL outside the grid or if it
+ * has no plan
+ */
+const struct si5351e_plan *si5351e_table_lookup(const struct si5351e_table *table,
+                                                uint32_t clk);
+
+/* output MS for an additional clock (>= 1MHz) on the PLL of plan */
+int si5351e_output(const struct si5351e_plan *plan, uint32_t clk, struct si5351_ms *ms);
+
+/* AN619 registers for a MultiSynth: 8 bytes starting at MSNA/MSNB
+ * (rdiv = 0) or MSx
+ */
+void si5351e_encode(const struct si5351_ms *ms, uint8_t rdiv, uint8_t regs[8]);
+
+/* the body of si5351e_plan(): inlined with a constant xtal (see
+ * si5351e_plan_fixed()) the range check, the CLKIN_DIV selection and the
+ * feedback MS bound 90 xtal / 2^clkin_div fold into constants
+ */
+static inline int si5351e_plan_inline(uint32_t xtal, uint32_t clk, struct si5351e_plan *plan)
+{
+    if (xtal < SI5351E_MIN_CLKIN_FREQ || xtal > SI5351E_MAX_CLKIN_FREQ)
+        return SI5351_ERR_XTAL_RANGE;
+    plan->xtal = xtal;
+    plan->clkin_div = SI5351E_CLKIN_DIV(xtal);
+
+    /* R divider for clocks below 1MHz */
+    uint64_t r_clk = clk;
+    plan->rdiv = 0;
+    while (r_clk < 1000000 && plan->rdiv < 7) {
+        r_clk <<= 1;
+        plan->rdiv++;
+    }
+    if (r_clk < 1000000)
+        return SI5351_ERR_CLOCK_LOW;
+
+    /* highest even output MS within the VCO range and feedback MS <= 90 */
+    uint64_t ms = SI5351E_MAX_VCO_FREQ / r_clk;
+    uint64_t ms_feedback = (((uint64_t)90 * xtal) >> plan->clkin_div) / r_clk;
+    if (ms > ms_feedback)
+        ms = ms_feedback;
+    if (ms > 900)
+        ms = 900;
+    ms -= ms % 2;
+    if (ms < 4)
+        return SI5351_ERR_OUTPUT_MS;
+    uint64_t vco = ms * r_clk;
+    if (vco < SI5351E_MIN_VCO_FREQ)
+        return SI5351_ERR_FEEDBACK_MS;
+
+    plan->output = (struct si5351_ms){(uint32_t)ms, 0, 1};
+    si5351e_approximate(vco << plan->clkin_div, xtal, &plan->feedback);
+    return SI5351_OK;
+}
+
+/* firmware for a single board can build with -DSI5351E_XTAL=<Hz> and plan
+ * with si5351e_plan_fixed(clk, plan); an out of range xtal is a compile
+ * time error
+ */
+#ifdef SI5351E_XTAL
+_Static_assert(SI5351E_XTAL >= SI5351E_MIN_CLKIN_FREQ && SI5351E_XTAL <= SI5351E_MAX_CLKIN_FREQ,
+               "SI5351E_XTAL is outside 10-100MHz");
+
+static inline int si5351e_plan_fixed(uint32_t clk, struct si5351e_plan *plan)
+{
+    return si5351e_plan_inline(SI5351E_XTAL, clk, plan);
+}
+#endif
+
+#endif /* SI5351EMBEDDED_H */
@@ -0,0 +1,93 @@
+/* Si5351 frequency planning library - output MS fine tuning
+ *
+ * Copyright 2024, Franco Venturi, K4VZ
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <math.h>
+#include <stdint.h>
+
+#include "si5351plan.h"
+#include "si5351internal.h"
+
+/* the best rational approximation of a target a few Hz away only shares
+ * the convergents with a small denominator (those coarser than the
+ * offset) with the current one, so resuming its continued fraction does
+ * not save much over starting over. The finest grid of output MS values,
+ * b / 1048575, is uniform instead: the nearest point is one rounded
+ * division. Its resolution is relative to the output MS, 1/2097150 of it
+ * at most: below 5ppb from MS 96 up, but up to 60ppb at MS 8, so for the
+ * high clocks the grid point is replaced by the best approximation when
+ * it is too far off (except next to an integer MS, where the gap of the
+ * Farey sequence is the grid step and nothing is closer)
+ */
+
+int si5351_fine_tune_init(struct si5351_fine_tune *tune,
+                          const struct si5351_plan_result *plan,
+                          double xtal, int nclk)
+{
+    if (nclk < 0 || nclk >= plan->nclks || si5351_integer_only(nclk) || !plan->valid[nclk])
+        return SI5351_ERR_FINE_TUNE;
+    if (xtal != floor(xtal) || xtal < 1 || xtal > 4e9)
+        return SI5351_ERR_FINE_TUNE;
+
+    const struct si5351_ms *fb = &plan->feedback[plan->pll[nclk]];
+    tune->nclk = nclk;
+    tune->pll_num = (uint64_t)xtal * ((uint64_t)fb->a * fb->c + fb->b);
+    tune->pll_den = (uint64_t)fb->c << plan->clkin_div;
+    return SI5351_OK;
+}
+
+int si5351_fine_tune(const struct si5351_fine_tune *tune, double clk,
+                     struct si5351_plan_result *plan)
+{
+    int nclk = tune->nclk;
+    uint8_t rdiv = plan->rdiv[nclk];
+    if (clk != floor(clk) || clk < 1 || clk > 4e9)
+        return SI5351_ERR_FINE_TUNE;
+
+    /* MS = pll_num / (pll_den clk 2^rdiv) = a + n / den */
+    uint64_t den = tune->pll_den * ((uint64_t)clk << rdiv);
+    uint64_t a = tune->pll_num / den;
+    uint64_t n = tune->pll_num % den;
+    uint64_t b = (uint64_t)(((u128)n * SI5351_MAX_DENOMINATOR + den / 2) / den);
+    struct si5351_ms ms = {(uint32_t)a, (uint32_t)b, SI5351_MAX_DENOMINATOR};
+    if (b == 0 || b == SI5351_MAX_DENOMINATOR)
+        ms = (struct si5351_ms){(uint32_t)a + (b != 0), 0, 1};
+    if (a > 900)
+        return SI5351_ERR_OUTPUT_MS;
+
+    /* the grid error is at most 1 / (2097150 a) of the MS, so it can only
+     * be above SI5351_FINE_TUNE_MAX_PPB below MS 96; there, compare
+     * |b den - n 1048575| / (1048575 pll_num) with it (both sides below
+     * 2^112)
+     */
+    if ((uint64_t)a * 2 * SI5351_MAX_DENOMINATOR * SI5351_FINE_TUNE_MAX_PPB < 1000000000) {
+        u128 x = (u128)b * den;
+        u128 y = (u128)n * SI5351_MAX_DENOMINATOR;
+        u128 error = (x > y ? x - y : y - x) * 1000000000;
+        if (error > (u128)SI5351_FINE_TUNE_MAX_PPB * SI5351_MAX_DENOMINATOR * tune->pll_num)
+            si5351_rational_approximation_exact(tune->pll_num, den, SI5351_MAX_DENOMINATOR, &ms.a, &ms.b, &ms.c);
+    }
+    if (!si5351_valid_output_ms(&ms))
+        return SI5351_ERR_OUTPUT_MS;
+
+    double pll_freq = plan->pll_freq[plan->pll[nclk]];
+    double clk_diff = si5351_clock_diff(1, clk, rdiv, pll_freq, tune->pll_num, tune->pll_den, &ms);
+    plan->output[nclk] = ms;
+    plan->clks[nclk] = clk;
+    plan->actual[nclk] = clk + clk_diff;
+    plan->clk_diff[nclk] = clk_diff;
+
+    plan->max_clk_diff = 0;
+    plan->max_ppb = 0;
+    for (int i = 0; i < plan->nclks; i++) {
+        if (!plan->valid[i])
+            continue;
+        plan->max_clk_diff = fmax(plan->max_clk_diff, fabs(plan->clk_diff[i]));
+        plan->max_ppb = fmax(plan->max_ppb, fabs(plan->clk_diff[i]) / plan->clks[i] * 1e9);
+    }
+    si5351_plan_quality(plan, &plan->quality);
+    return SI5351_OK;
+}
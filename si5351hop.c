@@ -0,0 +1,175 @@
+/* Si5351 frequency planning library - hop schedules
+ *
+ * Copyright 2024, Franco Venturi, K4VZ
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "si5351plan.h"
+#include "si5351internal.h"
+
+/* all the rational approximations of a hop sequence are done here, before
+ * the first hop: what is left for the timing critical path is a list of
+ * register writes. With SI5351_HOP_ALTERNATE the PLL of the next hop is
+ * idle during the current one, so its feedback MS and its soft reset can
+ * be written (and the PLL can lock) in advance
+ */
+
+struct hop_registers {
+    uint8_t image[SI5351_REG_IMAGE_SIZE];
+    uint8_t control[SI5351_MAX_CLOCKS];
+    int programmed;             /* 0 before the first hop */
+};
+
+
+/* every clock of PLL from on PLL to */
+static void move_pll(struct si5351_plan_result *plan, int from, int to)
+{
+    if (from == to)
+        return;
+    plan->pll_freq[to] = plan->pll_freq[from];
+    plan->feedback[to] = plan->feedback[from];
+    plan->pll_freq[from] = 0;
+    plan->feedback[from] = (struct si5351_ms){0, 0, 1};
+    for (int nclk = 0; nclk < plan->nclks; nclk++) {
+        if (plan->pll[nclk] == from)
+            plan->pll[nclk] = (uint8_t)to;
+    }
+}
+
+/* hop on the PLL the previous hop (if any) is not using */
+static int plan_alternate(struct si5351_setup *setup,
+                          const struct si5351_optimize_options *options,
+                          const struct si5351_plan_result *previous,
+                          const struct si5351_plan_request *request,
+                          struct si5351_plan_result *plan)
+{
+    struct si5351_optimize_options single = *options;
+    single.top_k = 1;
+    single.plls = 1;
+
+    if (previous == NULL) {
+        int status = si5351_optimize(setup, request, &single, plan);
+        return status < 0 ? status : SI5351_OK;
+    }
+
+    /* the previous hop on the idle PLL with an invalid feedback MS: keeping
+     * the PLL always fails, so si5351_retune() either moves it keeping the
+     * output MS of a changed clock or plans the hop from scratch (on PLLA)
+     */
+    int active = previous->pll[0];
+    int idle = SI5351_PLLB - active;
+    struct si5351_plan_result start = *previous;
+    move_pll(&start, active, idle);
+    start.feedback[idle] = (struct si5351_ms){0, 0, 1};
+
+    int pll_reset;
+    int status = si5351_retune(setup, &single, &start, request, plan, &pll_reset);
+    if (status != SI5351_OK)
+        return status;
+    move_pll(plan, plan->pll[0], idle);
+
+    /* the active PLL keeps running the previous hop */
+    plan->pll_freq[active] = previous->pll_freq[active];
+    plan->feedback[active] = previous->feedback[active];
+    return SI5351_OK;
+}
+
+/* writes from registers to plan, updating registers */
+static void schedule_writes(struct hop_registers *registers, enum si5351_hop_mode mode,
+                            const struct si5351_plan_result *previous,
+                            struct si5351_hop *hop)
+{
+    const struct si5351_plan_result *plan = &hop->plan;
+    uint8_t image[SI5351_REG_IMAGE_SIZE];
+    struct si5351_reg_write delta[SI5351_REG_IMAGE_SIZE];
+
+    si5351_register_image(plan, image);
+    int ndelta = si5351_register_delta(registers->image, image, delta);
+    memcpy(registers->image, image, sizeof(image));
+
+    /* feedback MS writes of the hop PLL (the idle one when alternating) */
+    int pll = plan->pll[0];
+    uint8_t msn_first = (uint8_t)(SI5351_REG_MSNA + 8 * pll);
+    int nwrites = 0;
+    if (mode == SI5351_HOP_ALTERNATE) {
+        for (int i = 0; i < ndelta; i++) {
+            if (delta[i].reg >= msn_first && delta[i].reg < msn_first + 8)
+                hop->writes[nwrites++] = delta[i];
+        }
+        if (nwrites > 0) {
+            hop->writes[nwrites].reg = SI5351_REG_PLL_RESET;
+            hop->writes[nwrites].value = pll == SI5351_PLLA ? SI5351_PLLA_RESET : SI5351_PLLB_RESET;
+            nwrites++;
+        }
+    }
+    hop->npreload = nwrites;
+
+    for (int i = 0; i < ndelta; i++) {
+        if (mode != SI5351_HOP_ALTERNATE || delta[i].reg < msn_first || delta[i].reg >= msn_first + 8)
+            hop->writes[nwrites++] = delta[i];
+    }
+
+    /* then the MSx_SRC switches */
+    for (int nclk = 0; nclk < plan->nclks; nclk++) {
+        uint8_t control = si5351_clock_control(plan, nclk);
+        if (registers->programmed && control == registers->control[nclk])
+            continue;
+        hop->writes[nwrites].reg = (uint8_t)(SI5351_REG_CLK0_CONTROL + nclk);
+        hop->writes[nwrites].value = control;
+        nwrites++;
+        registers->control[nclk] = control;
+    }
+
+    /* and the soft reset of any PLL with a new feedback MS integer part */
+    if (mode == SI5351_HOP_RETUNE) {
+        uint8_t reset = 0;
+        for (int p = SI5351_PLLA; p <= SI5351_PLLB; p++) {
+            if (plan->pll_freq[p] == 0)
+                continue;
+            if (previous == NULL || previous->pll_freq[p] == 0 ||
+                plan->feedback[p].a != previous->feedback[p].a)
+                reset |= p == SI5351_PLLA ? SI5351_PLLA_RESET : SI5351_PLLB_RESET;
+        }
+        if (reset != 0) {
+            hop->writes[nwrites].reg = SI5351_REG_PLL_RESET;
+            hop->writes[nwrites].value = reset;
+            nwrites++;
+        }
+    }
+    hop->nswitch = nwrites - hop->npreload;
+    registers->programmed = 1;
+}
+
+int si5351_hop_schedule(struct si5351_setup *setup,
+                        const struct si5351_optimize_options *options,
+                        enum si5351_hop_mode mode,
+                        const struct si5351_plan_request *requests, int nhops,
+                        struct si5351_hop *hops)
+{
+    struct hop_registers registers;
+    memset(&registers, 0, sizeof(registers));
+
+    const struct si5351_plan_result *previous = NULL;
+    int nplanned = 0;
+    for (int i = 0; i < nhops; i++) {
+        struct si5351_hop *hop = &hops[i];
+        hop->npreload = 0;
+        hop->nswitch = 0;
+        if (mode == SI5351_HOP_ALTERNATE) {
+            hop->status = plan_alternate(setup, options, previous, &requests[i], &hop->plan);
+        } else {
+            int pll_reset;
+            hop->status = si5351_retune(setup, options, previous, &requests[i], &hop->plan, &pll_reset);
+        }
+        if (hop->status != SI5351_OK)
+            continue;
+        schedule_writes(&registers, mode, previous, hop);
+        previous = &hop->plan;
+        nplanned++;
+    }
+    return nplanned;
+}
@@ -0,0 +1,177 @@
+/* Si5351 frequency planning library - internal definitions
+ *
+ * Copyright 2024, Franco Venturi, K4VZ
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef SI5351INTERNAL_H
+#define SI5351INTERNAL_H
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "si5351plan.h"
+
+static const double SI5351_MIN_VCO_FREQ = 600e6;
+static const double SI5351_MAX_VCO_FREQ = 1000e6;
+static const uint32_t SI5351_MAX_DENOMINATOR = 1048575;
+static const double SI5351_MIN_CLKIN_FREQ = 10e6;
+static const double SI5351_MAX_CLKIN_FREQ = 100e6;
+/* clock difference (Hz) considered exact */
+static const double SI5351_EXACT_TOLERANCE = 1e-8;
+/* si5351_retune() error bound when options->max_ppb is 0 */
+static const double SI5351_RETUNE_MAX_PPB = 1.0;
+
+/* si5351_arena_alloc() alignment (a power of 2) */
+static const size_t SI5351_ARENA_ALIGN = _Alignof(max_align_t);
+
+__extension__ typedef unsigned __int128 u128;
+__extension__ typedef __int128 i128;
+
+/* integer Hz requests are planned with the exact rational approximation */
+static inline int si5351_is_integer_hz(const struct si5351_plan_request *request)
+{
+    if (request->xtal != floor(request->xtal))
+        return 0;
+    for (int nclk = 0; nclk < request->nclks; nclk++) {
+        double clk = request->clks[nclk];
+        if (clk < 1 || clk > 4e9 || clk != floor(clk))
+            return 0;
+    }
+    return 1;
+}
+
+/* R divider (log2) bringing clk above 1MHz as in si5351_setup(), but
+ * limited to the 128 of the hardware; -1 if clk is too low
+ */
+static inline int si5351_rdiv(double clk, double *r_clk)
+{
+    int rdiv = 0;
+    *r_clk = clk;
+    while (*r_clk < 1e6 && rdiv < 7) {
+        *r_clk *= 2.0;
+        rdiv += 1;
+    }
+    return *r_clk < 1e6 ? -1 : rdiv;
+}
+
+/* ms ~= num / den (through the cache, if any) */
+static inline void si5351_approximate_exact(struct si5351_cache *cache,
+                                            uint64_t num, uint64_t den,
+                                            struct si5351_ms *ms)
+{
+    if (cache != NULL) {
+        si5351_cache_approximation(cache, num, den, SI5351_MAX_DENOMINATOR, &ms->a, &ms->b, &ms->c);
+    } else {
+        si5351_rational_approximation_exact(num, den, SI5351_MAX_DENOMINATOR, &ms->a, &ms->b, &ms->c);
+    }
+}
+
+/* ms ~= num / den if exact, value otherwise */
+static inline void si5351_approximate(int exact, struct si5351_cache *cache,
+                                      uint64_t num, uint64_t den,
+                                      double value, struct si5351_ms *ms)
+{
+    if (exact) {
+        si5351_approximate_exact(cache, num, den, ms);
+    } else {
+        si5351_rational_approximation(value, SI5351_MAX_DENOMINATOR, &ms->a, &ms->b, &ms->c);
+    }
+}
+
+/* MS6 and MS7 (no fractional mode) */
+static inline int si5351_integer_only(int nclk)
+{
+    return nclk >= SI5351_FIRST_INTEGER_ONLY_CLOCK;
+}
+
+/* output MS of clock nclk ~= num / den if exact, ratio otherwise; the
+ * nearest even integer for MS6 and MS7
+ */
+static inline void si5351_approximate_output(int nclk, int exact, struct si5351_cache *cache,
+                                             uint64_t num, uint64_t den,
+                                             double ratio, struct si5351_ms *ms)
+{
+    if (si5351_integer_only(nclk)) {
+        *ms = (struct si5351_ms){2 * (uint32_t)floor(ratio / 2 + 0.5), 0, 1};
+        return;
+    }
+    si5351_approximate(exact, cache, num, den, ratio, ms);
+}
+
+static inline double si5351_ms_value(const struct si5351_ms *ms)
+{
+    return ms->a + (double)ms->b / (double)ms->c;
+}
+
+/* AN619: output MS can be 4, 6, 8 or any fractional value in 8-900 */
+static inline int si5351_valid_output_ms(const struct si5351_ms *ms)
+{
+    if (ms->b == 0)
+        return ms->a == 4 || ms->a == 6 || (ms->a >= 8 && ms->a <= 900);
+    return ms->a >= 8 && ms->a < 900;
+}
+
+/* MS6 and MS7 can only be even integers in 6-254 */
+static inline int si5351_valid_clock_ms(int nclk, const struct si5351_ms *ms)
+{
+    if (si5351_integer_only(nclk))
+        return ms->b == 0 && ms->a % 2 == 0 && ms->a >= 6 && ms->a <= 254;
+    return si5351_valid_output_ms(ms);
+}
+
+/* AN619: feedback MS can be any value in 15-90 */
+static inline int si5351_valid_feedback_ms(const struct si5351_ms *ms)
+{
+    return ms->a >= 15 && (ms->a < 90 || (ms->a == 90 && ms->b == 0));
+}
+
+static inline double si5351_ms_penalty(const struct si5351_optimize_options *options,
+                                       const struct si5351_ms *ms)
+{
+    if (ms->b != 0)
+        return options->fractional_penalty;
+    if (ms->a % 2)
+        return options->odd_integer_penalty;
+    return 0;
+}
+
+/* actual - requested for a clock from PLL frequency pll_num / pll_den
+ * (pll_freq if not exact)
+ */
+static inline double si5351_clock_diff(int exact, double clk, uint8_t rdiv,
+                                       double pll_freq, uint64_t pll_num, uint64_t pll_den,
+                                       const struct si5351_ms *ms)
+{
+    if (exact) {
+        /* actual = pll_num c / (pll_den (a c + b) 2^rdiv) */
+        u128 ms_num = (u128)pll_den * ((uint64_t)ms->a * ms->c + ms->b) << rdiv;
+        i128 diff = (i128)((u128)pll_num * ms->c) - (i128)(ms_num * (uint64_t)clk);
+        return (double)diff / (double)ms_num;
+    }
+    return pll_freq / si5351_ms_value(ms) / (1 << rdiv) - clk;
+}
+
+/* hot path counters: compiled out unless SI5351_STATS is defined */
+#ifdef SI5351_STATS
+extern _Thread_local struct si5351_stats si5351_thread_stats;
+#define SI5351_COUNT(field) (si5351_thread_stats.field++)
+#else
+#define SI5351_COUNT(field) ((void)0)
+#endif
+
+/* even output MS from 900 down to 4 */
+#define SI5351_SCENARIO1_CANDIDATES ((900 - 4) / 2 + 1)
+
+/* keep[i] = 0 if output MS output_ms - 2 i cannot give a valid plan in the
+ * first scenario (VCO, feedback MS or output MS ratio of any clock out of
+ * range); vectorized with AVX2 or NEON when the compiler targets them
+ */
+void si5351_prefilter_scenario1(const struct si5351_setup *setup,
+                                const struct si5351_plan_request *request,
+                                uint32_t output_ms, int ncandidates,
+                                uint8_t *keep);
+
+#endif /* SI5351INTERNAL_H */
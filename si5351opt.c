@@ -0,0 +1,512 @@
+/* Si5351 frequency planning library - global optimizer
+ *
+ * Copyright 2024, Franco Venturi, K4VZ
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "si5351plan.h"
+#include "si5351internal.h"
+
+/* the VCO frequency candidates are derived from every integer feedback MS
+ * and from every integer output MS of each clock; the other dividers are
+ * then the best rational approximations for that VCO frequency. This
+ * covers both scenarios of si5351_plan() (and everything in between), and
+ * candidates are dropped as soon as their partial cost exceeds the worst
+ * of the top-K plans found so far.
+ *
+ * With two PLLs every group of clocks (bitmask) is first solved on its own
+ * PLL; each partition of the clocks into a PLLA group (the one with clock 0,
+ * since PLLA and PLLB are interchangeable) and a PLLB group then just
+ * combines the top-K lists of its two groups. Groups with the same set of
+ * frequencies share the same solution.
+ *
+ * The output MS of a clock only depends on the VCO frequency, not on the
+ * group, so every VCO candidate is evaluated once for all the clocks and
+ * the group searches only add up these results: with 8 clocks the 255
+ * groups cost no more rational approximations than a single one.
+ */
+
+/* top-K plans, sorted by cost */
+struct plan_list {
+    struct si5351_plan_result *plans;
+    int nplans;
+    int top_k;
+};
+
+/* output MS of a clock for a VCO candidate */
+struct clock_fit {
+    struct si5351_ms ms;
+    double clk_diff;
+    double ppb;
+    double penalty;
+};
+
+/* VCO frequency candidate, in search order */
+struct vco {
+    struct si5351_ms feedback;
+    double pll_freq;
+    double penalty;             /* feedback MS */
+    int fixed_clk;              /* integer output MS of this clock (-1 if none) */
+    unsigned invalid;           /* clocks without a valid output MS */
+    struct clock_fit *fits;     /* one for each clock */
+};
+
+struct optimizer {
+    const struct si5351_optimize_options *options;
+    struct si5351_cache *cache;
+    int exact;
+    int nclks;
+    uint8_t clkin_div;
+    double xtal;                        /* after CLKIN_DIV */
+    uint64_t xtal_hz;                   /* before CLKIN_DIV */
+    double clks[SI5351_MAX_CLOCKS];
+    double r_clks[SI5351_MAX_CLOCKS];   /* clocks before the R divider */
+    uint64_t r_clks_hz[SI5351_MAX_CLOCKS];
+    uint8_t rdiv[SI5351_MAX_CLOCKS];
+    struct plan_list groups[1 << SI5351_MAX_CLOCKS];    /* by clock mask */
+    struct vco *vcos;
+    int nvcos;
+};
+
+
+/* from arena if there is one (all released together), the heap otherwise */
+static void *scratch_alloc(struct si5351_arena *arena, size_t n, size_t size)
+{
+    if (arena == NULL)
+        return calloc(n, size);
+    if (n > SIZE_MAX / size)
+        return NULL;
+    return si5351_arena_alloc(arena, n * size);
+}
+
+static void scratch_free(struct si5351_arena *arena, void *p)
+{
+    if (arena == NULL)
+        free(p);
+}
+
+size_t si5351_optimize_scratch_size(int nclks, const struct si5351_optimize_options *options)
+{
+    size_t ngroups = options->plls > 1 ? (1u << nclks) - 1 : 1;
+    size_t nvcos = 90 - 15 + 1 + (size_t)nclks * (900 - 4 + 1);
+    /* the three allocations below, their rounding and a misaligned buffer */
+    return ngroups * options->top_k * sizeof(struct si5351_plan_result) +
+           nvcos * sizeof(struct vco) + nvcos * nclks * sizeof(struct clock_fit) +
+           4 * SI5351_ARENA_ALIGN;
+}
+
+void si5351_optimize_defaults(struct si5351_optimize_options *options)
+{
+    options->top_k = 1;
+    options->plls = 2;
+    options->max_ppb = 0;
+    options->fractional_penalty = 0.01;
+    options->odd_integer_penalty = 0.005;
+}
+
+
+static double worst_cost(const struct plan_list *list)
+{
+    if (list->nplans < list->top_k)
+        return HUGE_VAL;
+    return list->plans[list->nplans - 1].cost;
+}
+
+static int same_plan(const struct si5351_plan_result *p1,
+                     const struct si5351_plan_result *p2, unsigned mask)
+{
+    if (memcmp(p1->feedback, p2->feedback, sizeof(p1->feedback)) != 0)
+        return 0;
+    for (int nclk = 0; nclk < p1->nclks; nclk++) {
+        if (!(mask & (1u << nclk)))
+            continue;
+        if (p1->pll[nclk] != p2->pll[nclk] ||
+            memcmp(&p1->output[nclk], &p2->output[nclk], sizeof(p1->output[nclk])) != 0)
+            return 0;
+    }
+    return 1;
+}
+
+/* insert into the list (sorted by cost, ties keep the first found) */
+static void keep_top_k(struct plan_list *list, const struct si5351_plan_result *plan,
+                       unsigned mask)
+{
+    for (int i = 0; i < list->nplans; i++) {
+        if (same_plan(&list->plans[i], plan, mask))
+            return;
+    }
+    int i = list->nplans < list->top_k ? list->nplans++ : list->top_k - 1;
+    while (i > 0 && list->plans[i - 1].cost > plan->cost) {
+        list->plans[i] = list->plans[i - 1];
+        i--;
+    }
+    list->plans[i] = *plan;
+}
+
+
+/* integer output MS range of a clock within the VCO range (ms_max < ms_min
+ * if there is none)
+ */
+static void ms_range(const struct optimizer *opt, int nclk,
+                     uint32_t *ms_min, uint32_t *ms_max)
+{
+    double r_clk = opt->r_clks[nclk];
+    int integer_only = si5351_integer_only(nclk);
+    *ms_max = (uint32_t)(SI5351_MAX_VCO_FREQ / r_clk);
+    *ms_min = (uint32_t)ceil(SI5351_MIN_VCO_FREQ / r_clk);
+    if (*ms_max > (integer_only ? 254 : 900))
+        *ms_max = integer_only ? 254 : 900;
+    if (*ms_min < (integer_only ? 6 : 4))
+        *ms_min = integer_only ? 6 : 4;
+}
+
+/* evaluate every clock on the PLL with feedback MS fb, where fixed_clk (if
+ * >= 0) uses the integer output MS fixed_ms; returns 0 (and adds nothing)
+ * if fb is invalid or the VCO is out of range
+ */
+static int add_vco(struct optimizer *opt, const struct si5351_ms *fb,
+                   int fixed_clk, uint32_t fixed_ms)
+{
+    const struct si5351_optimize_options *options = opt->options;
+    struct vco *vco = &opt->vcos[opt->nvcos];
+
+    if (!si5351_valid_feedback_ms(fb))
+        return 0;
+    double pll_freq = opt->xtal * si5351_ms_value(fb);
+    if (pll_freq < SI5351_MIN_VCO_FREQ || pll_freq > SI5351_MAX_VCO_FREQ)
+        return 0;
+    uint64_t pll_num = opt->xtal_hz * ((uint64_t)fb->a * fb->c + fb->b);
+    uint64_t pll_den = (uint64_t)fb->c << opt->clkin_div;
+
+    vco->feedback = *fb;
+    vco->pll_freq = pll_freq;
+    vco->penalty = si5351_ms_penalty(options, fb);
+    vco->fixed_clk = fixed_clk;
+    vco->invalid = 0;
+    for (int nclk = 0; nclk < opt->nclks; nclk++) {
+        struct clock_fit *fit = &vco->fits[nclk];
+        if (nclk == fixed_clk) {
+            fit->ms = (struct si5351_ms){fixed_ms, 0, 1};
+        } else {
+            double ratio = pll_freq / opt->r_clks[nclk];
+            if (ratio < 4 || ratio > 901) {
+                vco->invalid |= 1u << nclk;
+                continue;
+            }
+            si5351_approximate_output(nclk, opt->exact, opt->cache, pll_num, pll_den * opt->r_clks_hz[nclk], ratio, &fit->ms);
+        }
+        if (!si5351_valid_clock_ms(nclk, &fit->ms)) {
+            vco->invalid |= 1u << nclk;
+            continue;
+        }
+        fit->clk_diff = si5351_clock_diff(opt->exact, opt->clks[nclk], opt->rdiv[nclk], pll_freq, pll_num, pll_den, &fit->ms);
+        fit->ppb = fabs(fit->clk_diff) / opt->clks[nclk] * 1e9;
+        fit->penalty = si5351_ms_penalty(options, &fit->ms);
+    }
+    opt->nvcos++;
+    return 1;
+}
+
+/* upper bound on the number of VCO candidates */
+static int max_vcos(const struct optimizer *opt)
+{
+    int nvcos = 90 - 15 + 1;
+    for (int nclk = 0; nclk < opt->nclks; nclk++) {
+        uint32_t ms_min, ms_max;
+        ms_range(opt, nclk, &ms_min, &ms_max);
+        if (ms_max >= ms_min)
+            nvcos += (int)(ms_max - ms_min + 1);
+    }
+    return nvcos;
+}
+
+/* all the VCO candidates: integer feedback MS, then the integer output MS
+ * of each clock (even ones first)
+ */
+static void add_vcos(struct optimizer *opt)
+{
+    struct si5351_ms fb;
+
+    for (int odd = 0; odd <= 1; odd++) {
+        for (uint32_t a = 90 - odd; a >= 15; a -= 2) {
+            fb = (struct si5351_ms){a, 0, 1};
+            add_vco(opt, &fb, -1, 0);
+        }
+    }
+
+    for (int odd = 0; odd <= 1; odd++) {
+        for (int nclk = 0; nclk < opt->nclks; nclk++) {
+            uint32_t ms_min, ms_max;
+            ms_range(opt, nclk, &ms_min, &ms_max);
+            if (ms_max < ms_min || (odd && si5351_integer_only(nclk)))
+                continue;
+            if (ms_max % 2 != (uint32_t)odd)
+                ms_max--;
+            for (uint32_t ms = ms_max; ms >= ms_min && ms <= ms_max; ms -= 2) {
+                if (ms == 5 || ms == 7)
+                    continue;
+                double f_vco = opt->r_clks[nclk] * ms;
+                uint64_t fb_num = (opt->r_clks_hz[nclk] * ms) << opt->clkin_div;
+                si5351_approximate(opt->exact, opt->cache, fb_num, opt->xtal_hz, f_vco / opt->xtal, &fb);
+                add_vco(opt, &fb, nclk, ms);
+            }
+        }
+    }
+}
+
+
+/* plan the clocks in mask on PLLA with a VCO candidate. Returns 0 if the
+ * candidate is invalid or if its cost can't beat the current top-K of the
+ * group
+ */
+static int evaluate(const struct optimizer *opt, unsigned mask,
+                    const struct vco *vco, struct si5351_plan_result *plan)
+{
+    const struct si5351_optimize_options *options = opt->options;
+    double bound = worst_cost(&opt->groups[mask]);
+
+    SI5351_COUNT(optimizer_evaluations);
+    if (mask & vco->invalid)
+        return 0;
+    double penalty = vco->penalty;
+    if (penalty >= bound) {
+        SI5351_COUNT(optimizer_pruned);
+        return 0;
+    }
+
+    plan->pll_freq[SI5351_PLLA] = vco->pll_freq;
+    plan->feedback[SI5351_PLLA] = vco->feedback;
+
+    double max_ppb = 0;
+    plan->max_clk_diff = 0;
+    for (int nclk = 0; nclk < opt->nclks; nclk++) {
+        if (!(mask & (1u << nclk)))
+            continue;
+        const struct clock_fit *fit = &vco->fits[nclk];
+        penalty += fit->penalty;
+        if (fit->ppb > max_ppb)
+            max_ppb = fit->ppb;
+        if (max_ppb + penalty >= bound) {
+            SI5351_COUNT(optimizer_pruned);
+            return 0;
+        }
+        if (options->max_ppb > 0 && max_ppb > options->max_ppb)
+            return 0;
+
+        plan->output[nclk] = fit->ms;
+        plan->actual[nclk] = opt->clks[nclk] + fit->clk_diff;
+        plan->clk_diff[nclk] = fit->clk_diff;
+        if (fabs(fit->clk_diff) > plan->max_clk_diff)
+            plan->max_clk_diff = fabs(fit->clk_diff);
+    }
+
+    plan->max_ppb = max_ppb;
+    plan->cost = max_ppb + penalty;
+    return 1;
+}
+
+
+/* top-K plans for the clocks in mask sharing PLLA: the VCO candidates
+ * from an integer feedback MS or from the integer output MS of one of them
+ */
+static void search_group(struct optimizer *opt, unsigned mask,
+                         struct si5351_plan_result *plan)
+{
+    struct plan_list *list = &opt->groups[mask];
+    for (int i = 0; i < opt->nvcos; i++) {
+        const struct vco *vco = &opt->vcos[i];
+        if (vco->fixed_clk >= 0 && !(mask & (1u << vco->fixed_clk)))
+            continue;
+        if (evaluate(opt, mask, vco, plan))
+            keep_top_k(list, plan, mask);
+    }
+}
+
+/* reuse the solution of an already solved group with the same frequencies */
+static int reuse_group(struct optimizer *opt, unsigned mask, unsigned solved)
+{
+    for (unsigned other = 1; other < solved; other++) {
+        if (__builtin_popcount(other) != __builtin_popcount(mask))
+            continue;
+
+        /* map each clock in mask to an unused clock in other with the same
+         * frequency, R divider and output MS constraints (MS6/MS7 are even
+         * integers only)
+         */
+        int map[SI5351_MAX_CLOCKS];
+        unsigned used = 0;
+        int nclk;
+        for (nclk = 0; nclk < opt->nclks; nclk++) {
+            if (!(mask & (1u << nclk)))
+                continue;
+            int oclk;
+            for (oclk = 0; oclk < opt->nclks; oclk++) {
+                if ((other & ~used & (1u << oclk)) && opt->clks[oclk] == opt->clks[nclk] &&
+                    opt->rdiv[oclk] == opt->rdiv[nclk] &&
+                    si5351_integer_only(oclk) == si5351_integer_only(nclk))
+                    break;
+            }
+            if (oclk == opt->nclks)
+                break;
+            map[nclk] = oclk;
+            used |= 1u << oclk;
+        }
+        if (nclk < opt->nclks)
+            continue;
+
+        struct plan_list *list = &opt->groups[mask];
+        const struct plan_list *olist = &opt->groups[other];
+        list->nplans = olist->nplans;
+        for (int i = 0; i < olist->nplans; i++) {
+            struct si5351_plan_result *plan = &list->plans[i];
+            const struct si5351_plan_result *oplan = &olist->plans[i];
+            *plan = *oplan;
+            for (nclk = 0; nclk < opt->nclks; nclk++) {
+                if (!(mask & (1u << nclk)))
+                    continue;
+                plan->output[nclk] = oplan->output[map[nclk]];
+                plan->actual[nclk] = oplan->actual[map[nclk]];
+                plan->clk_diff[nclk] = oplan->clk_diff[map[nclk]];
+            }
+        }
+        return 1;
+    }
+    return 0;
+}
+
+/* PLLA group plan_a plus PLLB group plan_b */
+static void combine(const struct optimizer *opt, unsigned mask_b,
+                    const struct si5351_plan_result *plan_a,
+                    const struct si5351_plan_result *plan_b,
+                    struct si5351_plan_result *plan)
+{
+    *plan = *plan_a;
+    plan->pll_freq[SI5351_PLLB] = plan_b->pll_freq[SI5351_PLLA];
+    plan->feedback[SI5351_PLLB] = plan_b->feedback[SI5351_PLLA];
+    for (int nclk = 0; nclk < opt->nclks; nclk++) {
+        if (!(mask_b & (1u << nclk)))
+            continue;
+        plan->pll[nclk] = SI5351_PLLB;
+        plan->output[nclk] = plan_b->output[nclk];
+        plan->actual[nclk] = plan_b->actual[nclk];
+        plan->clk_diff[nclk] = plan_b->clk_diff[nclk];
+    }
+    if (plan_b->max_clk_diff > plan->max_clk_diff)
+        plan->max_clk_diff = plan_b->max_clk_diff;
+    double penalty = (plan_a->cost - plan_a->max_ppb) + (plan_b->cost - plan_b->max_ppb);
+    plan->max_ppb = fmax(plan_a->max_ppb, plan_b->max_ppb);
+    plan->cost = plan->max_ppb + penalty;
+}
+
+
+int si5351_optimize(struct si5351_setup *setup,
+                    const struct si5351_plan_request *request,
+                    const struct si5351_optimize_options *options,
+                    struct si5351_plan_result *results)
+{
+    if (request->nclks < 1 || request->nclks > SI5351_MAX_CLOCKS)
+        return SI5351_ERR_NCLKS;
+    if (options->top_k < 1)
+        return SI5351_ERR_NO_PLAN;
+    int status = si5351_setup(setup, request->xtal, request->clks[0]);
+    if (status != SI5351_OK)
+        return status;
+
+    struct optimizer opt = {
+        .options = options,
+        .cache = setup->cache,
+        .exact = si5351_is_integer_hz(request),
+        .nclks = request->nclks,
+        .clkin_div = setup->clkin_div,
+        .xtal = setup->xtal,
+        .xtal_hz = (uint64_t)request->xtal,
+    };
+
+    for (int nclk = 0; nclk < request->nclks; nclk++) {
+        int rdiv = si5351_rdiv(request->clks[nclk], &opt.r_clks[nclk]);
+        if (rdiv < 0)
+            return SI5351_ERR_CLOCK_LOW;
+        opt.clks[nclk] = request->clks[nclk];
+        opt.r_clks_hz[nclk] = (uint64_t)request->clks[nclk] << rdiv;
+        opt.rdiv[nclk] = (uint8_t)rdiv;
+    }
+
+    unsigned all = (1u << request->nclks) - 1;
+    int ngroups = options->plls > 1 ? (int)all : 1;
+    int nvcos = max_vcos(&opt);
+    struct si5351_arena *arena = setup->arena;
+    size_t arena_used = arena != NULL ? arena->used : 0;
+    struct si5351_plan_result *plans = scratch_alloc(arena, (size_t)ngroups * options->top_k, sizeof(*plans));
+    opt.vcos = scratch_alloc(arena, nvcos, sizeof(*opt.vcos));
+    struct clock_fit *fits = scratch_alloc(arena, (size_t)nvcos * request->nclks, sizeof(*fits));
+    if (plans == NULL || opt.vcos == NULL || fits == NULL) {
+        scratch_free(arena, plans);
+        scratch_free(arena, opt.vcos);
+        scratch_free(arena, fits);
+        if (arena != NULL)
+            arena->used = arena_used;
+        return SI5351_ERR_NOMEM;
+    }
+    for (int i = 0; i < nvcos; i++)
+        opt.vcos[i].fits = &fits[(size_t)i * request->nclks];
+    add_vcos(&opt);
+
+    struct si5351_plan_result plan;
+    plan.status = SI5351_OK;
+    plan.scenario = 0;
+    plan.nclks = request->nclks;
+    plan.clkin_div = setup->clkin_div;
+    plan.pll_freq[SI5351_PLLB] = 0;
+    plan.feedback[SI5351_PLLB] = (struct si5351_ms){0, 0, 1};
+    for (int nclk = 0; nclk < request->nclks; nclk++) {
+        plan.pll[nclk] = SI5351_PLLA;
+        plan.rdiv[nclk] = opt.rdiv[nclk];
+        plan.valid[nclk] = 1;
+        plan.clks[nclk] = request->clks[nclk];
+    }
+
+    /* solve each group of clocks on its own PLL */
+    for (unsigned mask = options->plls > 1 ? 1 : all; mask <= all; mask++) {
+        struct plan_list *list = &opt.groups[mask];
+        list->plans = options->plls > 1 ? &plans[(mask - 1) * options->top_k] : plans;
+        list->nplans = 0;
+        list->top_k = options->top_k;
+        if (!reuse_group(&opt, mask, mask))
+            search_group(&opt, mask, &plan);
+    }
+
+    /* all the clocks on PLLA, then PLLA + PLLB partitions */
+    struct plan_list best = {results, 0, options->top_k};
+    const struct plan_list *group_all = &opt.groups[all];
+    for (int i = 0; i < group_all->nplans; i++)
+        keep_top_k(&best, &group_all->plans[i], all);
+    for (unsigned mask_a = 1; options->plls > 1 && mask_a < all; mask_a += 2) {
+        const struct plan_list *group_a = &opt.groups[mask_a];
+        const struct plan_list *group_b = &opt.groups[all ^ mask_a];
+        /* the combined cost is at least the cost of either group */
+        for (int i = 0; i < group_a->nplans && group_a->plans[i].cost < worst_cost(&best); i++) {
+            for (int j = 0; j < group_b->nplans && group_b->plans[j].cost < worst_cost(&best); j++) {
+                combine(&opt, all ^ mask_a, &group_a->plans[i], &group_b->plans[j], &plan);
+                if (plan.cost < worst_cost(&best))
+                    keep_top_k(&best, &plan, all);
+            }
+        }
+    }
+
+    scratch_free(arena, plans);
+    scratch_free(arena, opt.vcos);
+    scratch_free(arena, fits);
+    if (arena != NULL)
+        arena->used = arena_used;
+    if (best.nplans == 0)
+        return SI5351_ERR_NO_PLAN;
+    for (int i = 0; i < best.nplans; i++)
+        si5351_plan_quality(&results[i], &results[i].quality);
+    return best.nplans;
+}
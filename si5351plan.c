@@ -0,0 +1,663 @@
+/* Si5351 frequency planning library
+ *
+ * Copyright 2024, Franco Venturi, K4VZ
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "si5351plan.h"
+#include "si5351internal.h"
+
+
+int si5351_setup(struct si5351_setup *setup, double xtal, double clk0)
+{
+    /* a zero-initialized setup has nothing to reuse, not a 0Hz xtal and
+     * clock 0
+     */
+    int reuse = setup->valid;
+    setup->valid = 1;
+
+    if (!reuse || xtal != setup->xtal_orig) {
+        setup->xtal_orig = xtal;
+        setup->xtal = xtal;
+        setup->clkin_div = 0;
+        setup->xtal_status = SI5351_OK;
+        setup->feedback_ms_max = 0;
+
+        /* make sure xtal (CLKIN) is in the allowed 10-100MHz range */
+        if (!(xtal >= SI5351_MIN_CLKIN_FREQ && xtal <= SI5351_MAX_CLKIN_FREQ)) {
+            setup->xtal_status = SI5351_ERR_XTAL_RANGE;
+        } else {
+            /* bring xtal (CLKIN) within the 10-40MHz range using CLKIN_DIV */
+            while (setup->xtal > 40e6 && setup->clkin_div <= 3) {
+                setup->xtal /= 2.0;
+                setup->clkin_div += 1;
+            }
+
+            /* choose an even integer for the feedback MS */
+            uint32_t feedback_ms = ((uint32_t)(SI5351_MAX_VCO_FREQ / setup->xtal));
+            feedback_ms -= feedback_ms % 2;
+            if (feedback_ms > 90)
+                feedback_ms = 90;
+            setup->feedback_ms_max = feedback_ms;
+        }
+    }
+
+    if (!reuse || clk0 != setup->clk0) {
+        setup->clk0 = clk0;
+        setup->clk0_status = SI5351_OK;
+        setup->output_ms_max = 0;
+
+        /* if the requested clock is below 1MHz, use an R divider (up to
+         * R = 128)
+         */
+        int rdiv = clk0 > 0 ? si5351_rdiv(clk0, &setup->r_clk0) : -1;
+        if (rdiv < 0) {
+            setup->clk0_status = SI5351_ERR_CLOCK_LOW;
+            setup->r_clk0 = 0;
+            setup->rdiv = 7;
+        } else {
+            setup->rdiv = (uint8_t)rdiv;
+
+            /* choose an even integer for the output MS */
+            uint32_t output_ms = ((uint32_t)(SI5351_MAX_VCO_FREQ / setup->r_clk0));
+            output_ms -= output_ms % 2;
+            setup->output_ms_max = output_ms;
+        }
+    }
+
+    if (setup->xtal_status != SI5351_OK)
+        return setup->xtal_status;
+    return setup->clk0_status;
+}
+
+
+static void init_candidate(const struct si5351_setup *setup,
+                           const struct si5351_plan_request *request,
+                           int scenario, struct si5351_plan_result *candidate)
+{
+    candidate->status = SI5351_OK;
+    candidate->scenario = scenario;
+    candidate->clkin_div = setup->clkin_div;
+    candidate->nclks = request->nclks;
+    candidate->pll_freq[SI5351_PLLB] = 0;
+    candidate->feedback[SI5351_PLLB] = (struct si5351_ms){0, 0, 1};
+    candidate->max_ppb = 0;
+    candidate->cost = 0;
+    for (int nclk = 0; nclk < request->nclks; nclk++) {
+        candidate->pll[nclk] = SI5351_PLLA;
+        candidate->rdiv[nclk] = 0;
+        candidate->valid[nclk] = 1;
+        candidate->clks[nclk] = request->clks[nclk];
+    }
+    candidate->rdiv[0] = setup->rdiv;
+}
+
+/* clock 0 error plus the output MS for the additional clocks;
+ * pll_num / pll_den is the exact PLL frequency (pll_den == 0 if not known)
+ */
+static void evaluate_clocks(const struct si5351_setup *setup,
+                            const struct si5351_plan_request *request,
+                            double actual_clk0, uint64_t pll_num, uint64_t pll_den,
+                            struct si5351_plan_result *candidate)
+{
+    double pll_freq = candidate->pll_freq[SI5351_PLLA];
+
+    candidate->actual[0] = actual_clk0;
+    candidate->clk_diff[0] = actual_clk0 - request->clks[0];
+    candidate->max_clk_diff = fabs(candidate->clk_diff[0]);
+    candidate->max_ppb = fabs(candidate->clk_diff[0]) / request->clks[0] * 1e9;
+
+    for (int nclk = 1; nclk < request->nclks; nclk++) {
+        struct si5351_ms *ms = &candidate->output[nclk];
+        /* the candidate is reused across the search: clear the previous one */
+        candidate->valid[nclk] = 1;
+        candidate->actual[nclk] = 0;
+        candidate->clk_diff[nclk] = 0;
+        if (si5351_integer_only(nclk)) {
+            si5351_approximate_output(nclk, 0, NULL, 0, 0, pll_freq / request->clks[nclk], ms);
+            if (!si5351_valid_clock_ms(nclk, ms)) {
+                SI5351_COUNT(rejected_output_ms);
+                candidate->valid[nclk] = 0;
+                candidate->max_clk_diff = HUGE_VAL;
+                candidate->max_ppb = HUGE_VAL;
+                continue;
+            }
+        } else if (pll_den != 0) {
+            uint64_t clk = (uint64_t)request->clks[nclk];
+            if (pll_num / pll_den / clk > 900) {
+                SI5351_COUNT(rejected_output_ms);
+                candidate->valid[nclk] = 0;
+                candidate->max_clk_diff = HUGE_VAL;
+                candidate->max_ppb = HUGE_VAL;
+                continue;
+            }
+            si5351_approximate_exact(setup->cache, pll_num, pll_den * clk, ms);
+        } else {
+            si5351_rational_approximation(pll_freq / request->clks[nclk], SI5351_MAX_DENOMINATOR, &ms->a, &ms->b, &ms->c);
+        }
+
+        double clk_actual_ratio = ms->a + (double)ms->b / (double)ms->c;
+        if (clk_actual_ratio < 4 || clk_actual_ratio > 900) {
+            SI5351_COUNT(rejected_output_ms);
+            candidate->valid[nclk] = 0;
+            candidate->max_clk_diff = HUGE_VAL;
+            candidate->max_ppb = HUGE_VAL;
+            continue;
+        }
+
+        candidate->actual[nclk] = pll_freq / clk_actual_ratio;
+        candidate->clk_diff[nclk] = candidate->actual[nclk] - request->clks[nclk];
+        if (fabs(candidate->clk_diff[nclk]) > candidate->max_clk_diff)
+            candidate->max_clk_diff = fabs(candidate->clk_diff[nclk]);
+        double ppb = fabs(candidate->clk_diff[nclk]) / request->clks[nclk] * 1e9;
+        if (ppb > candidate->max_ppb)
+            candidate->max_ppb = ppb;
+    }
+}
+
+
+/* scenario search flags */
+#define SEARCH_PREFILTER 0x01           /* skip hopeless candidates silently */
+#define SEARCH_INTEGER_FEEDBACK 0x02    /* only integer feedback MS */
+#define SEARCH_FRACTIONAL_FEEDBACK 0x04 /* only fractional feedback MS */
+
+/* first scenario - N-frac for feedback MS and even integer for output MS;
+ * with SEARCH_PREFILTER, the candidates with an invalid feedback MS or an
+ * output MS ratio out of range for any clock are skipped without calling
+ * fn (as are those excluded by the feedback flags). The search ends early
+ * when stop (if not NULL) becomes non-zero
+ */
+static int scenario1(const struct si5351_setup *setup,
+                     const struct si5351_plan_request *request,
+                     unsigned flags, const int *stop,
+                     si5351_candidate_fn fn, void *arg)
+{
+    double xtal = setup->xtal;
+    double r_clk0 = setup->r_clk0;
+    struct si5351_plan_result candidate;
+
+    if (request->nclks < 1 || request->nclks > SI5351_MAX_CLOCKS)
+        return SI5351_ERR_NCLKS;
+    if (setup->xtal_status != SI5351_OK)
+        return setup->xtal_status;
+    if (setup->clk0_status != SI5351_OK)
+        return setup->clk0_status;
+
+    uint32_t output_ms = setup->output_ms_max;
+    if (output_ms < 4 || output_ms > 900)
+        return SI5351_ERR_OUTPUT_MS;
+
+    init_candidate(setup, request, 1, &candidate);
+    int exact = si5351_is_integer_hz(request);
+    uint64_t xtal_hz = (uint64_t)setup->xtal_orig;
+    uint64_t r_clk0_hz = (uint64_t)setup->clk0 << setup->rdiv;
+
+    int prefilter = flags & SEARCH_PREFILTER;
+    unsigned feedback_flags = flags & (SEARCH_INTEGER_FEEDBACK | SEARCH_FRACTIONAL_FEEDBACK);
+    uint8_t keep[SI5351_SCENARIO1_CANDIDATES];
+    if (prefilter)
+        si5351_prefilter_scenario1(setup, request, output_ms, (output_ms - 4) / 2 + 1, keep);
+
+    /* try different values for f_VCO */
+    for (uint32_t output_ms_max = output_ms; output_ms >= 4; output_ms -= 2) {
+        if (stop != NULL && *stop)
+            break;
+        SI5351_COUNT(candidates);
+        if (prefilter && !keep[(output_ms_max - output_ms) / 2]) {
+            SI5351_COUNT(rejected_prefilter);
+            continue;
+        }
+        double f_vco = r_clk0 * output_ms;
+        if (f_vco < SI5351_MIN_VCO_FREQ)
+            break;
+
+        if (feedback_flags != 0) {
+            int integer_feedback = exact ? ((r_clk0_hz * output_ms) << setup->clkin_div) % xtal_hz == 0 :
+                                           f_vco / xtal == floor(f_vco / xtal);
+            if (!(feedback_flags & (integer_feedback ? SEARCH_INTEGER_FEEDBACK : SEARCH_FRACTIONAL_FEEDBACK)))
+                continue;
+        }
+
+        candidate.output[0].a = output_ms;
+        candidate.output[0].b = 0;
+        candidate.output[0].c = 1;
+
+        /* feedback MS */
+        double feedback_ms = f_vco / xtal;
+        if (feedback_ms < 15 || feedback_ms > 90) {
+            SI5351_COUNT(rejected_feedback_ms);
+            candidate.status = SI5351_ERR_FEEDBACK_MS;
+            candidate.pll_freq[SI5351_PLLA] = f_vco;
+            candidate.max_clk_diff = HUGE_VAL;
+            fn(&candidate, arg);
+            candidate.status = SI5351_OK;
+            continue;
+        }
+
+        /* find a good rational approximation for feedback_ms */
+        struct si5351_ms *fb = &candidate.feedback[SI5351_PLLA];
+        uint64_t pll_num = 0;
+        uint64_t pll_den = 0;
+        if (exact) {
+            uint64_t fb_num = (r_clk0_hz * output_ms) << setup->clkin_div;
+            si5351_approximate_exact(setup->cache, fb_num, xtal_hz, fb);
+            pll_num = xtal_hz * ((uint64_t)fb->a * fb->c + fb->b);
+            pll_den = (uint64_t)fb->c << setup->clkin_div;
+        } else {
+            si5351_rational_approximation(feedback_ms, SI5351_MAX_DENOMINATOR, &fb->a, &fb->b, &fb->c);
+        }
+        double actual_ratio = fb->a + (double)fb->b / (double)fb->c;
+        candidate.pll_freq[SI5351_PLLA] = xtal * actual_ratio;
+
+        evaluate_clocks(setup, request, candidate.pll_freq[SI5351_PLLA] / output_ms / (1 << setup->rdiv), pll_num, pll_den, &candidate);
+        fn(&candidate, arg);
+    }
+
+    return SI5351_OK;
+}
+
+int si5351_plan_scenario1(const struct si5351_setup *setup,
+                          const struct si5351_plan_request *request,
+                          si5351_candidate_fn fn, void *arg)
+{
+    return scenario1(setup, request, 0, NULL, fn, arg);
+}
+
+
+/* second scenario - even integer for feedback MS and N-frac for output MS */
+static int scenario2(const struct si5351_setup *setup,
+                     const struct si5351_plan_request *request,
+                     const int *stop, si5351_candidate_fn fn, void *arg)
+{
+    double xtal = setup->xtal;
+    double r_clk0 = setup->r_clk0;
+    struct si5351_plan_result candidate;
+
+    if (request->nclks < 1 || request->nclks > SI5351_MAX_CLOCKS)
+        return SI5351_ERR_NCLKS;
+    if (setup->xtal_status != SI5351_OK)
+        return setup->xtal_status;
+    if (setup->clk0_status != SI5351_OK)
+        return setup->clk0_status;
+
+    uint32_t feedback_ms = setup->feedback_ms_max;
+    if (feedback_ms < 16)
+        return SI5351_ERR_FEEDBACK_MS;
+    if (xtal * feedback_ms < SI5351_MIN_VCO_FREQ)
+        return SI5351_ERR_FEEDBACK_MS;
+
+    init_candidate(setup, request, 2, &candidate);
+    int exact = si5351_is_integer_hz(request);
+    uint64_t xtal_hz = (uint64_t)setup->xtal_orig;
+    uint64_t r_clk0_hz = (uint64_t)setup->clk0 << setup->rdiv;
+
+    /* try different values for f_VCO */
+    for (; feedback_ms >= 16; feedback_ms -= 2) {
+        if (stop != NULL && *stop)
+            break;
+        SI5351_COUNT(candidates);
+        double f_vco = xtal * feedback_ms;
+        if (f_vco < SI5351_MIN_VCO_FREQ)
+            break;
+
+        candidate.feedback[SI5351_PLLA].a = feedback_ms;
+        candidate.feedback[SI5351_PLLA].b = 0;
+        candidate.feedback[SI5351_PLLA].c = 1;
+        candidate.pll_freq[SI5351_PLLA] = f_vco;
+
+        /* find a good rational approximation for output_ms */
+        struct si5351_ms *ms = &candidate.output[0];
+        uint64_t pll_num = 0;
+        uint64_t pll_den = 0;
+        if (exact) {
+            pll_num = xtal_hz * feedback_ms;
+            pll_den = (uint64_t)1 << setup->clkin_div;
+            si5351_approximate_exact(setup->cache, pll_num, pll_den * r_clk0_hz, ms);
+        } else {
+            si5351_rational_approximation(f_vco / r_clk0, SI5351_MAX_DENOMINATOR, &ms->a, &ms->b, &ms->c);
+        }
+        /* above 900 when the R divider leaves clock 0 just over 1MHz */
+        if (!si5351_valid_output_ms(ms)) {
+            candidate.status = SI5351_ERR_OUTPUT_MS;
+            candidate.max_clk_diff = HUGE_VAL;
+            fn(&candidate, arg);
+            candidate.status = SI5351_OK;
+            continue;
+        }
+        double actual_ratio = ms->a + (double)ms->b / (double)ms->c;
+
+        evaluate_clocks(setup, request, f_vco / actual_ratio / (1 << setup->rdiv), pll_num, pll_den, &candidate);
+        fn(&candidate, arg);
+    }
+
+    return SI5351_OK;
+}
+
+int si5351_plan_scenario2(const struct si5351_setup *setup,
+                          const struct si5351_plan_request *request,
+                          si5351_candidate_fn fn, void *arg)
+{
+    return scenario2(setup, request, NULL, fn, arg);
+}
+
+
+static void keep_best(const struct si5351_plan_result *candidate, void *arg)
+{
+    struct si5351_plan_result *best = arg;
+    if (candidate->status == SI5351_OK && candidate->max_clk_diff < best->max_clk_diff)
+        *best = *candidate;
+}
+
+/* e1 is a worse candidate than e2 */
+static int worse(const struct si5351_best_entry *e1, const struct si5351_best_entry *e2)
+{
+    if (e1->plan.max_clk_diff != e2->plan.max_clk_diff)
+        return e1->plan.max_clk_diff > e2->plan.max_clk_diff;
+    /* fractional MultiSynths count as 2, odd integer ones as 1 */
+    int r1 = 2 * e1->plan.quality.nfractional + e1->plan.quality.nodd;
+    int r2 = 2 * e2->plan.quality.nfractional + e2->plan.quality.nodd;
+    if (r1 != r2)
+        return r1 > r2;
+    return e1->seq > e2->seq;
+}
+
+/* restore the max-heap (worst candidate at the root) below entry i */
+static void sift_down(struct si5351_best_entry *entries, int n, int i)
+{
+    while (1) {
+        int worst = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+        if (left < n && worse(&entries[left], &entries[worst]))
+            worst = left;
+        if (right < n && worse(&entries[right], &entries[worst]))
+            worst = right;
+        if (worst == i)
+            return;
+        struct si5351_best_entry tmp = entries[i];
+        entries[i] = entries[worst];
+        entries[worst] = tmp;
+        i = worst;
+    }
+}
+
+void si5351_best_candidate(const struct si5351_plan_result *candidate, void *arg)
+{
+    struct si5351_best *best = arg;
+    if (candidate->status != SI5351_OK || candidate->max_clk_diff == HUGE_VAL)
+        return;
+
+    struct si5351_best_entry entry = {*candidate, best->seq++};
+    si5351_plan_quality(&entry.plan, &entry.plan.quality);
+    if (best->n < best->k) {
+        /* sift up */
+        int i = best->n++;
+        while (i > 0 && worse(&entry, &best->entries[(i - 1) / 2])) {
+            best->entries[i] = best->entries[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+        best->entries[i] = entry;
+        return;
+    }
+    if (best->k == 0 || !worse(&best->entries[0], &entry))
+        return;
+    best->entries[0] = entry;
+    sift_down(best->entries, best->n, 0);
+}
+
+int si5351_best_sort(struct si5351_best *best)
+{
+    /* heap sort: move the worst to the end */
+    for (int n = best->n; n > 1; n--) {
+        struct si5351_best_entry tmp = best->entries[0];
+        best->entries[0] = best->entries[n - 1];
+        best->entries[n - 1] = tmp;
+        sift_down(best->entries, n - 1, 0);
+    }
+    return best->n;
+}
+
+int si5351_plan(struct si5351_setup *setup,
+                const struct si5351_plan_request *request,
+                struct si5351_plan_result *result)
+{
+    if (request->nclks < 1 || request->nclks > SI5351_MAX_CLOCKS)
+        return SI5351_ERR_NCLKS;
+    int status = si5351_setup(setup, request->xtal, request->clks[0]);
+    if (status != SI5351_OK)
+        return status;
+
+    result->scenario = 0;
+    result->max_clk_diff = HUGE_VAL;
+    int status1 = scenario1(setup, request, SEARCH_PREFILTER, NULL, keep_best, result);
+    int status2 = scenario2(setup, request, NULL, keep_best, result);
+
+    if (result->scenario == 0) {
+        if (status1 != SI5351_OK)
+            return status1;
+        if (status2 != SI5351_OK)
+            return status2;
+        return SI5351_ERR_NO_PLAN;
+    }
+    result->status = SI5351_OK;
+    si5351_plan_quality(result, &result->quality);
+    return SI5351_OK;
+}
+
+
+struct first {
+    struct si5351_plan_result *result;
+    double max_ppb;
+    int done;
+};
+
+static void keep_first(const struct si5351_plan_result *candidate, void *arg)
+{
+    struct first *first = arg;
+    if (candidate->status != SI5351_OK)
+        return;
+    const struct si5351_ms *ms0 = &candidate->output[0];
+    int good_enough = first->max_ppb > 0 ? candidate->max_ppb <= first->max_ppb :
+                      candidate->max_clk_diff < SI5351_EXACT_TOLERANCE && ms0->b == 0 && ms0->a % 2 == 0;
+    if (good_enough) {
+        *first->result = *candidate;
+        first->done = 1;
+        return;
+    }
+    keep_best(candidate, first->result);
+}
+
+int si5351_plan_first(struct si5351_setup *setup,
+                      const struct si5351_plan_request *request,
+                      double max_ppb, struct si5351_plan_result *result)
+{
+    if (request->nclks < 1 || request->nclks > SI5351_MAX_CLOCKS)
+        return SI5351_ERR_NCLKS;
+    int status = si5351_setup(setup, request->xtal, request->clks[0]);
+    if (status != SI5351_OK)
+        return status;
+
+    /* the likeliest exact plans first: integer feedback MS with the even
+     * integer output MS of the first scenario, then the (even integer)
+     * feedback MS of the second scenario, then the fractional ones
+     */
+    struct first first = {result, max_ppb, 0};
+    result->scenario = 0;
+    result->max_clk_diff = HUGE_VAL;
+    int status1 = scenario1(setup, request, SEARCH_PREFILTER | SEARCH_INTEGER_FEEDBACK, &first.done, keep_first, &first);
+    int status2 = scenario2(setup, request, &first.done, keep_first, &first);
+    if (status1 == SI5351_OK)
+        scenario1(setup, request, SEARCH_PREFILTER | SEARCH_FRACTIONAL_FEEDBACK, &first.done, keep_first, &first);
+
+    if (result->scenario == 0) {
+        if (status1 != SI5351_OK)
+            return status1;
+        if (status2 != SI5351_OK)
+            return status2;
+        return SI5351_ERR_NO_PLAN;
+    }
+    result->status = SI5351_OK;
+    si5351_plan_quality(result, &result->quality);
+    return SI5351_OK;
+}
+
+
+const char *si5351_strerror(int status)
+{
+    switch (status) {
+    case SI5351_OK:
+        return "ok";
+    case SI5351_ERR_XTAL_RANGE:
+        return "xtal_out_of_range";
+    case SI5351_ERR_CLOCK_LOW:
+        return "clock_too_low";
+    case SI5351_ERR_OUTPUT_MS:
+        return "invalid_output_ms";
+    case SI5351_ERR_FEEDBACK_MS:
+        return "invalid_feedback_ms";
+    case SI5351_ERR_NO_PLAN:
+        return "no_plan";
+    case SI5351_ERR_NCLKS:
+        return "invalid_number_of_clocks";
+    case SI5351_ERR_NOMEM:
+        return "out_of_memory";
+    case SI5351_ERR_TABLE:
+        return "invalid_table";
+    case SI5351_ERR_FINE_TUNE:
+        return "cannot_fine_tune";
+    }
+    return "unknown_error";
+}
+
+
+/* best rational approximation:
+ *
+ *     value ~= a + b/c     (where c <= max_denominator)
+ *
+ * References:
+ * - https://en.wikipedia.org/wiki/Continued_fraction#Best_rational_approximations
+ */
+void si5351_rational_approximation(double value, uint32_t max_denominator,
+                                   uint32_t *a, uint32_t *b, uint32_t *c)
+{
+    const double epsilon = 1e-5;
+
+    SI5351_COUNT(approximations);
+    double af;
+    double f0 = modf(value, &af);
+    *a = (uint32_t) af;
+    *b = 0;
+    *c = 1;
+    double f = f0;
+    double delta = f0;
+    /* we need to take into account that the fractional part has a_0 = 0 */
+    uint32_t h[] = {1, 0};
+    uint32_t k[] = {0, 1};
+    for(int i = 0; i < 100; ++i){
+        if(f <= epsilon){
+            break;
+        }
+        if(k[1] > max_denominator){
+            break;
+        }
+        double anf;
+        f = modf(1.0 / f,&anf);
+        SI5351_COUNT(cf_terms);
+        uint32_t an = (uint32_t) anf;
+        /* the semiconvergents (m h[1] + h[0]) / (m k[1] + k[0]) get closer
+         * to f0 as m grows, so only the largest admissible m can improve
+         * on delta: it is bounded by max_denominator and by the half rule
+         */
+        uint32_t m = an;
+        if(k[0] > max_denominator){
+            m = 0;
+        } else if((max_denominator - k[0]) / k[1] < m){
+            m = (max_denominator - k[0]) / k[1];
+        }
+        if(m >= (an + 1) / 2 && m > 0){
+            SI5351_COUNT(semiconvergents);
+            uint32_t hm = m * h[1] + h[0];
+            uint32_t km = m * k[1] + k[0];
+            double d = fabs((double) hm / (double) km - f0);
+            if(d < delta){
+                delta = d;
+                *b = hm;
+                *c = km;
+            }
+        }
+        uint32_t hn = an * h[1] + h[0];
+        uint32_t kn = an * k[1] + k[0];
+        h[0] = h[1]; h[1] = hn;
+        k[0] = k[1]; k[1] = kn;
+    }
+    return;
+}
+
+
+/* best rational approximation of an exact ratio of integers:
+ *
+ *     num / den ~= a + b/c     (where c <= max_denominator)
+ *
+ * same as si5351_rational_approximation(), but the continued fraction
+ * expansion runs on the integer remainders (Euclid's algorithm), so it
+ * neither depends on an epsilon nor on an iteration cap: it stops when the
+ * next convergent denominator exceeds max_denominator (at most ~30 terms
+ * for a 20 bit denominator) or when the expansion terminates. The best
+ * semiconvergent is then picked directly instead of scanning them all.
+ * b/c is never 1/1: that case is returned as (a + 1) + 0/1.
+ *
+ * requires den > 0 and num / den < 2^32
+ */
+void si5351_rational_approximation_exact(uint64_t num, uint64_t den,
+                                         uint32_t max_denominator,
+                                         uint32_t *a, uint32_t *b, uint32_t *c)
+{
+    SI5351_COUNT(exact_approximations);
+    *a = (uint32_t)(num / den);
+    uint64_t n = num % den;
+    uint64_t d = den;
+
+    /* convergents of n/d: h[1]/k[1] is the latest one, h[0]/k[0] the previous */
+    uint64_t h[] = {0, 1};
+    uint64_t k[] = {1, 0};
+    while (d != 0) {
+        uint64_t an = n / d;
+        SI5351_COUNT(cf_terms);
+        uint64_t kn = an * k[1] + k[0];
+        if (kn > max_denominator)
+            break;
+        uint64_t hn = an * h[1] + h[0];
+        h[0] = h[1]; h[1] = hn;
+        k[0] = k[1]; k[1] = kn;
+        uint64_t r = n - an * d;
+        n = d;
+        d = r;
+    }
+
+    if (d != 0) {
+        SI5351_COUNT(semiconvergents);
+        /* the complete quotient at this point is x' = n / d; the largest
+         * admissible semiconvergent (h[0] + m h[1]) / (k[0] + m k[1]) is
+         * closer than the convergent h[1]/k[1] iff x' k[1] < k[0] + 2 m k[1]
+         */
+        uint64_t m = (max_denominator - k[0]) / k[1];
+        if ((u128)n * k[1] < (u128)d * (k[0] + 2 * m * k[1])) {
+            h[1] = h[0] + m * h[1];
+            k[1] = k[0] + m * k[1];
+        }
+    }
+
+    *b = (uint32_t)h[1];
+    *c = (uint32_t)k[1];
+    if (*b == *c) {
+        *a += 1;
+        *b = 0;
+        *c = 1;
+    }
+    return;
+}
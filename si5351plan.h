@@ -0,0 +1,559 @@
+/* Si5351 frequency planning library
+ *
+ * Copyright 2024, Franco Venturi, K4VZ
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef SI5351PLAN_H
+#define SI5351PLAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* CLK0-CLK7 (Si5351A 20-QFN, Si5351B and Si5351C); the 3 output parts
+ * only use the first three
+ */
+#define SI5351_MAX_CLOCKS 8
+/* MS6 and MS7 only divide by an even integer in 6-254 (AN619) */
+#define SI5351_FIRST_INTEGER_ONLY_CLOCK 6
+
+#define SI5351_PLLA 0
+#define SI5351_PLLB 1
+
+/* status codes (negative values are errors) */
+enum si5351_status {
+    SI5351_OK = 0,
+    SI5351_ERR_XTAL_RANGE = -1,     /* xtal (CLKIN) outside 10-100MHz */
+    SI5351_ERR_CLOCK_LOW = -2,      /* clock 0 too low even with R divider */
+    SI5351_ERR_OUTPUT_MS = -3,      /* no valid output MS (first scenario) */
+    SI5351_ERR_FEEDBACK_MS = -4,    /* no valid feedback MS */
+    SI5351_ERR_NO_PLAN = -5,        /* no candidate for all the clocks */
+    SI5351_ERR_NCLKS = -6,          /* number of clocks out of range */
+    SI5351_ERR_NOMEM = -7,          /* out of memory */
+    SI5351_ERR_TABLE = -8,          /* invalid plan table */
+    SI5351_ERR_FINE_TUNE = -9,      /* clock cannot be fine tuned */
+};
+
+/* MultiSynth divider: a + b / c */
+struct si5351_ms {
+    uint32_t a;
+    uint32_t b;
+    uint32_t c;
+};
+
+/* bounded cache of exact rational approximations (see si5351_cache_init()) */
+struct si5351_cache_entry {
+    uint64_t num;               /* den == 0: empty */
+    uint64_t den;
+    uint32_t max_denominator;
+    struct si5351_ms ms;
+};
+
+struct si5351_cache {
+    struct si5351_cache_entry *entries;
+    uint32_t mask;              /* number of entries - 1 */
+    uint64_t hits;
+    uint64_t misses;
+};
+
+/* caller provided scratch memory (see si5351_arena_init()): a bump
+ * allocator, released by resetting used
+ */
+struct si5351_arena {
+    unsigned char *base;
+    size_t size;
+    size_t used;
+    size_t peak;                /* largest used so far */
+};
+
+struct si5351_plan_request {
+    double xtal;                        /* CLKIN frequency (Hz) */
+    int nclks;                          /* 1..SI5351_MAX_CLOCKS */
+    double clks[SI5351_MAX_CLOCKS];     /* requested clocks (Hz) */
+};
+
+/* CLKIN_DIV and R divider selection and the initial scenario dividers;
+ * zero-initialize once and pass to every call: they are only recomputed
+ * when xtal or clock 0 change from the previous request. Set cache to
+ * share the rational approximations of integer Hz requests across calls,
+ * and arena for the si5351_optimize() scratch memory to come from it
+ * instead of the heap
+ */
+struct si5351_setup {
+    struct si5351_cache *cache; /* optional */
+    struct si5351_arena *arena; /* optional */
+    int valid;                  /* the fields below are for xtal_orig and clk0 */
+    double xtal_orig;           /* nominal xtal (CLKIN) */
+    double xtal;                /* xtal after CLKIN_DIV */
+    uint8_t clkin_div;
+    int xtal_status;
+    uint32_t feedback_ms_max;   /* second scenario: initial even feedback MS */
+    double clk0;
+    double r_clk0;              /* clock 0 before the R divider */
+    uint8_t rdiv;
+    int clk0_status;
+    uint32_t output_ms_max;     /* first scenario: initial even output MS */
+};
+
+/* MultiSynth modes, lowest jitter first */
+enum si5351_ms_class {
+    SI5351_MS_EVEN_INTEGER,
+    SI5351_MS_ODD_INTEGER,
+    SI5351_MS_FRACTIONAL,
+};
+
+/* plan quality metrics (see si5351_plan_quality()) */
+struct si5351_plan_quality {
+    double max_ppb;
+    double ppb[SI5351_MAX_CLOCKS];          /* |clk_diff| / clk (0 past nclks) */
+    uint8_t output_class[SI5351_MAX_CLOCKS];    /* enum si5351_ms_class */
+    uint8_t feedback_class[2];              /* even integer if unused */
+    uint8_t nfractional;                    /* fractional MultiSynths */
+    uint8_t nodd;                           /* odd integer MultiSynths */
+    uint32_t max_denominator;   /* largest c of a fractional MultiSynth (0:
+                                   none), a proxy for fractional spurs */
+    double vco_margin;          /* Hz between the used VCOs and 600/1000MHz */
+};
+
+struct si5351_plan_result {
+    int status;                 /* SI5351_OK or why this candidate was rejected */
+    int scenario;               /* 1: N-frac feedback MS, 2: N-frac output MS,
+                                   0: si5351_optimize() */
+    int nclks;
+    uint8_t clkin_div;
+    double pll_freq[2];                     /* PLLA, PLLB (0 if unused) */
+    struct si5351_ms feedback[2];
+    uint8_t pll[SI5351_MAX_CLOCKS];         /* SI5351_PLLA or SI5351_PLLB */
+    struct si5351_ms output[SI5351_MAX_CLOCKS];
+    uint8_t rdiv[SI5351_MAX_CLOCKS];
+    uint8_t valid[SI5351_MAX_CLOCKS];       /* output MS within 4-900 (even
+                                               6-254 for MS6 and MS7) */
+    double clks[SI5351_MAX_CLOCKS];         /* requested */
+    double actual[SI5351_MAX_CLOCKS];
+    double clk_diff[SI5351_MAX_CLOCKS];     /* actual - requested */
+    double max_clk_diff;                    /* HUGE_VAL if any clock is invalid */
+    double max_ppb;                         /* max clock difference (ppb) */
+    double cost;                            /* si5351_optimize() ranking */
+    struct si5351_plan_quality quality;     /* of the plans returned by the
+                                               planners (not of the scenario
+                                               candidates given to a
+                                               si5351_candidate_fn) */
+};
+
+struct si5351_optimize_options {
+    int top_k;                  /* number of plans to return (>= 1) */
+    int plls;                   /* 1: all the clocks on PLLA, 2: PLLA and PLLB */
+    double max_ppb;             /* drop plans with a larger clock error (0: no bound) */
+    /* plans are ranked by max clock error (ppb) plus these costs (ppb) */
+    double fractional_penalty;  /* for each fractional MultiSynth */
+    double odd_integer_penalty; /* for each odd integer MultiSynth */
+};
+
+/* xtal correction: the offset measured at calibration plus an optional
+ * temperature table (linear in between, the end values outside)
+ */
+#define SI5351_MAX_TEMP_POINTS 16
+
+struct si5351_calibration {
+    double ppb;                             /* (actual - nominal) / nominal */
+    int npoints;                            /* 0: no temperature table */
+    double temp[SI5351_MAX_TEMP_POINTS];    /* increasing */
+    double temp_ppb[SI5351_MAX_TEMP_POINTS];    /* added to ppb at temp[i] */
+};
+
+/* si5351_reverse_query() bounds */
+struct si5351_reverse_options {
+    double window;                      /* Hz either side of the target */
+    uint32_t max_feedback_denominator;  /* 1: integer feedback MS only */
+    uint32_t max_output_denominator;    /* 1: integer output MS only */
+};
+
+/* AN619 MultiSynth parameters */
+struct si5351_ms_params {
+    uint32_t p1;                /* 18 bits */
+    uint32_t p2;                /* 20 bits */
+    uint32_t p3;                /* 20 bits */
+};
+
+/* register image: MSNA (26-33), MSNB (34-41), MS0-MS5 (42-89, 8 registers
+ * each), MS6 and MS7 (90, 91: just P1 = the divide ratio) and their R
+ * dividers (92)
+ */
+#define SI5351_REG_MSNA 26
+#define SI5351_REG_MSNB 34
+#define SI5351_REG_MS0 42
+#define SI5351_REG_MS6 90
+#define SI5351_REG_MS7 91
+#define SI5351_REG_R6_R7 92
+#define SI5351_REG_IMAGE_FIRST SI5351_REG_MSNA
+#define SI5351_REG_IMAGE_SIZE (SI5351_REG_R6_R7 + 1 - SI5351_REG_MSNA)
+
+/* CLK0-CLK7 control (16-23) and PLL soft reset (177) */
+#define SI5351_REG_CLK0_CONTROL 16
+#define SI5351_REG_PLL_RESET 177
+#define SI5351_PLLA_RESET 0x20
+#define SI5351_PLLB_RESET 0x80
+
+/* CLK0-CLK5 initial phase offset in quarter VCO periods, 7 bits (165-170) */
+#define SI5351_REG_CLK0_PHOFF 165
+#define SI5351_MAX_PHOFF 127
+
+/* single register write for si5351_register_delta() */
+struct si5351_reg_write {
+    uint8_t reg;
+    uint8_t value;
+};
+
+/* hop schedules (see si5351_hop_schedule()) */
+enum si5351_hop_mode {
+    SI5351_HOP_ALTERNATE,       /* consecutive hops on PLLA and PLLB */
+    SI5351_HOP_RETUNE,          /* si5351_retune() from the previous hop */
+};
+
+/* image registers, clock controls and one PLL reset */
+#define SI5351_HOP_MAX_WRITES (SI5351_REG_IMAGE_SIZE + SI5351_MAX_CLOCKS + 1)
+
+struct si5351_hop {
+    int status;                 /* SI5351_OK or why there is no plan */
+    struct si5351_plan_result plan;     /* as programmed: with
+                                           SI5351_HOP_ALTERNATE the idle PLL
+                                           still has the previous hop */
+    int npreload;               /* writes[0..npreload): any time before the hop */
+    int nswitch;                /* then writes[npreload..+nswitch): at the hop */
+    struct si5351_reg_write writes[SI5351_HOP_MAX_WRITES];
+};
+
+/* I/Q outputs (see si5351_plan_quadrature()) */
+#define SI5351_QUADRATURE_WRITES 3
+
+struct si5351_quadrature {
+    struct si5351_plan_result plan;     /* clock 0 (I) and clock 1 (Q) */
+    uint8_t phoff;                      /* CLK1_PHOFF (CLK0_PHOFF is 0) */
+};
+
+/* precomputed plan table: header + count records for start + i * step */
+#define SI5351_TABLE_VERSION 1
+#define SI5351_TABLE_BYTE_ORDER 0x01020304
+#define SI5351_TABLE_VALID 0x01
+
+struct si5351_table_header {
+    char magic[8];              /* "SI5351T" */
+    uint32_t version;
+    uint32_t byte_order;        /* SI5351_TABLE_BYTE_ORDER in host order */
+    uint32_t record_size;
+    uint32_t count;
+    uint64_t xtal;              /* Hz */
+    uint64_t start;             /* Hz */
+    uint64_t step;              /* Hz */
+};
+
+struct si5351_table_record {
+    struct si5351_ms feedback;
+    struct si5351_ms output;
+    uint8_t rdiv;
+    uint8_t clkin_div;
+    uint8_t flags;              /* SI5351_TABLE_VALID if there is a plan */
+    uint8_t reserved;
+    float ppb;                  /* clock difference */
+};
+
+/* best K candidates of the scenarios (see si5351_best_candidate()) */
+struct si5351_best_entry {
+    struct si5351_plan_result plan;
+    uint32_t seq;               /* order found (ties keep the first) */
+};
+
+struct si5351_best {
+    struct si5351_best_entry *entries;  /* room for k */
+    int k;
+    int n;
+    uint32_t seq;
+};
+
+/* solver counters of the calling thread (all zero unless the library is
+ * built with -DSI5351_STATS)
+ */
+struct si5351_stats {
+    uint64_t approximations;        /* si5351_rational_approximation() calls */
+    uint64_t exact_approximations;  /* ..._exact() calls (cache misses) */
+    uint64_t cf_terms;              /* continued fraction terms visited */
+    uint64_t semiconvergents;       /* semiconvergents tested */
+    uint64_t candidates;            /* scenario VCO candidates */
+    uint64_t rejected_prefilter;    /* skipped by the first scenario prefilter */
+    uint64_t rejected_feedback_ms;  /* feedback MS outside 15-90 */
+    uint64_t rejected_output_ms;    /* additional clock output MS out of range */
+    uint64_t optimizer_evaluations; /* feedback MS evaluated by si5351_optimize() */
+    uint64_t optimizer_pruned;      /* evaluations cut short by the top-K bound */
+};
+
+/* called for every candidate VCO frequency of a scenario */
+typedef void (*si5351_candidate_fn)(const struct si5351_plan_result *candidate, void *arg);
+
+int si5351_setup(struct si5351_setup *setup, double xtal, double clk0);
+
+int si5351_plan_scenario1(const struct si5351_setup *setup,
+                          const struct si5351_plan_request *request,
+                          si5351_candidate_fn fn, void *arg);
+int si5351_plan_scenario2(const struct si5351_setup *setup,
+                          const struct si5351_plan_request *request,
+                          si5351_candidate_fn fn, void *arg);
+
+/* best plan (smallest max clock difference) across both scenarios */
+int si5351_plan(struct si5351_setup *setup,
+                const struct si5351_plan_request *request,
+                struct si5351_plan_result *result);
+
+/* si5351_candidate_fn keeping the best->k valid candidates in a bounded
+ * max-heap, ranked by max clock difference, then by fewer fractional and
+ * odd integer MultiSynths; zero-initialize best and set entries and k.
+ * si5351_best_sort() then sorts the entries best first and returns n
+ */
+void si5351_best_candidate(const struct si5351_plan_result *candidate, void *arg);
+int si5351_best_sort(struct si5351_best *best);
+
+/* like si5351_plan(), but trying the integer feedback MS candidates first
+ * and stopping at the first plan within max_ppb (0: exact, i.e. all the
+ * clock differences below 1e-8 Hz with an even integer output MS for clock
+ * 0); if there is none, this is the best plan
+ */
+int si5351_plan_first(struct si5351_setup *setup,
+                      const struct si5351_plan_request *request,
+                      double max_ppb, struct si5351_plan_result *result);
+
+void si5351_optimize_defaults(struct si5351_optimize_options *options);
+
+/* best options->top_k plans (sorted by cost) searching all the VCO
+ * frequencies given by an integer feedback MS or an integer output MS, and
+ * all the assignments of the clocks to PLLA and PLLB (plan->pll): each VCO
+ * frequency is evaluated once for every clock, so the cost of the
+ * approximations only grows linearly with the number of clocks per VCO;
+ * results must have room for options->top_k plans.
+ * Returns the number of plans found or a negative status
+ */
+int si5351_optimize(struct si5351_setup *setup,
+                    const struct si5351_plan_request *request,
+                    const struct si5351_optimize_options *options,
+                    struct si5351_plan_result *results);
+
+/* setup->arena bytes that are enough for si5351_optimize() of any
+ * request with up to nclks clocks (and for si5351_retune(),
+ * si5351_hop_schedule() and si5351_table_build(), which use it); the
+ * arena is back to the same used on return. With a smaller arena
+ * si5351_optimize() returns SI5351_ERR_NOMEM
+ */
+size_t si5351_optimize_scratch_size(int nclks, const struct si5351_optimize_options *options);
+
+/* quality metrics of plan (filled in as plan->quality by si5351_plan(),
+ * si5351_plan_first(), si5351_best_candidate(), si5351_optimize(),
+ * si5351_retune() and si5351_fine_tune())
+ */
+void si5351_plan_quality(const struct si5351_plan_result *plan,
+                         struct si5351_plan_quality *quality);
+/* < 0 if q1 is better than q2, > 0 if worse, 0 if as good: by max ppb,
+ * then fewer fractional and odd integer MultiSynths (a fractional one
+ * counting as two odd ones, as in si5351_best_candidate()), then the
+ * smaller max_denominator, then the larger vco_margin
+ */
+int si5351_quality_compare(const struct si5351_plan_quality *q1,
+                           const struct si5351_plan_quality *q2);
+
+/* retune from previous (NULL for the first plan) to request changing as few
+ * registers as possible: each PLL is either kept or moved to the VCO of an
+ * integer output MS of one of its changed clocks; falls back to the best
+ * si5351_optimize() plan when the xtal changes or the clock error is above
+ * options->max_ppb. *pll_reset is set when a feedback MS integer part
+ * changed (the PLL needs a soft reset)
+ */
+int si5351_retune(struct si5351_setup *setup,
+                  const struct si5351_optimize_options *options,
+                  const struct si5351_plan_result *previous,
+                  const struct si5351_plan_request *request,
+                  struct si5351_plan_result *plan, int *pll_reset);
+
+/* output MS grid error (ppb) above which si5351_fine_tune() takes the
+ * best rational approximation instead
+ */
+#define SI5351_FINE_TUNE_MAX_PPB 5
+
+/* si5351_fine_tune() state for one clock: its PLL frequency as a
+ * fraction
+ */
+struct si5351_fine_tune {
+    int nclk;
+    uint64_t pll_num;           /* PLL frequency pll_num / pll_den */
+    uint64_t pll_den;
+};
+
+/* fine tuning of clock nclk of plan (RIT, AFC): the PLL and the R divider
+ * stay the same and only the output MS changes. xtal is the one plan was
+ * made for; both it and each clock must be integer Hz, and nclk one of
+ * MS0-MS5 (SI5351_ERR_FINE_TUNE otherwise)
+ */
+int si5351_fine_tune_init(struct si5351_fine_tune *tune,
+                          const struct si5351_plan_result *plan,
+                          double xtal, int nclk);
+/* move clock tune->nclk of plan to clk with the nearest output MS
+ * a + b / 1048575 (or the integer a when b rounds to 0): a 128 bit
+ * multiply and divide instead of a continued fraction, and P3 stays the
+ * same from one correction to the next. That grid is within 1/2097150 of
+ * the exact MS, which is up to 60ppb at MS 8 (100MHz clocks): when it is
+ * more than SI5351_FINE_TUNE_MAX_PPB off, the output MS is the best
+ * rational approximation instead (si5351_rational_approximation_exact(),
+ * with its own P3). So the error is within SI5351_FINE_TUNE_MAX_PPB or
+ * the smallest possible; within 1/1048575 of an integer MS not even that
+ * is closer than the grid, and 1/2097150 of the MS stays the worst case.
+ * Updates the clock, its error and the plan max_ppb/max_clk_diff;
+ * SI5351_ERR_OUTPUT_MS if the output MS would be out of range (plan
+ * unchanged)
+ */
+int si5351_fine_tune(const struct si5351_fine_tune *tune, double clk,
+                     struct si5351_plan_result *plan);
+
+/* total correction (ppb) at temperature temp (ignored without a table) */
+double si5351_calibration_ppb(const struct si5351_calibration *calibration, double temp);
+
+/* the actual xtal frequency to plan for: xtal (1 + si5351_calibration_ppb() / 1e9) */
+double si5351_calibrated_xtal(const struct si5351_calibration *calibration,
+                              double xtal, double temp);
+
+/* fast re-plan for a new (calibrated) xtal: previous keeps its PLL
+ * assignment, CLKIN_DIV, output MS and R dividers, and each feedback MS
+ * is approximated again for the same VCO frequency, so the clocks move by
+ * no more than the feedback MS approximation error and only the MSNA/MSNB
+ * registers change. The clock errors are against previous->clks.
+ * SI5351_ERR_XTAL_RANGE or SI5351_ERR_FEEDBACK_MS when the correction is
+ * too large for the structure of previous (plan a new one instead)
+ */
+int si5351_recalibrate(const struct si5351_plan_result *previous, double xtal,
+                       struct si5351_plan_result *plan);
+
+/* clock 0 and clock 1 at clk on PLLA with clock 1 90 degrees behind:
+ * the phase offset only works with the same even integer output MS
+ * on both and no R divider, and a quarter of the output period is
+ * output MS quarter VCO periods, so CLK1_PHOFF is the output MS (at most
+ * 126, i.e. clk above 600MHz / 126 = 4.76MHz). The best first scenario
+ * candidate (si5351_quality_compare()) within these limits;
+ * SI5351_ERR_OUTPUT_MS if there is none
+ */
+int si5351_plan_quadrature(struct si5351_setup *setup, double xtal, double clk,
+                           struct si5351_quadrature *quadrature);
+
+/* the writes after the register image and the CLKx_CONTROL registers:
+ * CLK0_PHOFF, CLK1_PHOFF and the PLLA soft reset that starts both outputs
+ * together; returns SI5351_QUADRATURE_WRITES
+ */
+int si5351_quadrature_writes(const struct si5351_quadrature *quadrature,
+                             struct si5351_reg_write writes[SI5351_QUADRATURE_WRITES]);
+
+void si5351_reverse_defaults(struct si5351_reverse_options *options);
+
+/* the frequencies within options->window of target that clock 0 can
+ * produce exactly with low denominator MultiSynths, without planning every
+ * Hz of the window: for every R divider, a walk over the output MS values
+ * a + b / c (c <= max_output_denominator) that can reach the window from a
+ * 600-1000MHz VCO, and for each of them over the feedback MS values
+ * (c <= max_feedback_denominator) that give a clock within the window.
+ * The number of MS values visited grows with the square of each
+ * denominator bound. results get the max_results nearest ones (plans for
+ * target, clk_diff being the offset) sorted as si5351_quality_compare():
+ * nearest first, then the fewest fractional and odd integer MultiSynths;
+ * of the plans with the same frequency only the best one is kept.
+ * Returns the number of results or a negative status
+ */
+int si5351_reverse_query(double xtal, double target,
+                         const struct si5351_reverse_options *options,
+                         int max_results, struct si5351_plan_result *results);
+
+/* plan hops[0..nhops) for requests[0..nhops) up front, with the register
+ * writes of each hop from the previous one (all zeros before the first):
+ *
+ *   SI5351_HOP_ALTERNATE  each hop runs on the PLL the previous hop is not
+ *                         using, which is programmed and reset in advance
+ *                         (the preload writes); when the error bound of
+ *                         si5351_retune() allows it, the hop keeps the
+ *                         output MS of the previous one, so the writes at
+ *                         the hop are only the MSx_SRC switches
+ *   SI5351_HOP_RETUNE     each hop is si5351_retune() from the previous
+ *                         one and every write (then the PLL reset, if
+ *                         needed) is at the hop
+ *
+ * A hop without a plan keeps the registers of the previous one.
+ * Returns the number of hops with a plan
+ */
+int si5351_hop_schedule(struct si5351_setup *setup,
+                        const struct si5351_optimize_options *options,
+                        enum si5351_hop_mode mode,
+                        const struct si5351_plan_request *requests, int nhops,
+                        struct si5351_hop *hops);
+
+/* the table for count frequencies needs si5351_table_size(count) bytes;
+ * every record is the best single PLL plan from si5351_optimize()
+ */
+size_t si5351_table_size(uint32_t count);
+int si5351_table_build(struct si5351_setup *setup,
+                       const struct si5351_optimize_options *options,
+                       uint64_t xtal, uint64_t start, uint64_t step,
+                       uint32_t count, void *buffer);
+/* check the header before using a table from a file */
+int si5351_table_check(const void *data, size_t size);
+/* record for the grid point nearest to freq (NULL if outside or no plan) */
+const struct si5351_table_record *si5351_table_lookup(const struct si5351_table_header *table,
+                                                      uint64_t freq);
+
+void si5351_encode_ms(const struct si5351_ms *ms, struct si5351_ms_params *params);
+/* CLKx_CONTROL for clock nclk of a plan: powered up, MultiSynth source,
+ * 8mA drive, MSx_SRC = plan->pll[nclk] and MSx_INT for an even integer
+ * MS0-MS5 (bit 6 of CLK6/CLK7 is FBA_INT/FBB_INT and is left clear)
+ */
+uint8_t si5351_clock_control(const struct si5351_plan_result *plan, int nclk);
+/* registers SI5351_REG_IMAGE_FIRST.. for a plan, ready for a single I2C
+ * burst write (unused PLLs and clocks are left as zeros); every R divider
+ * must be 0-7, as in all the plans from the library
+ */
+void si5351_register_image(const struct si5351_plan_result *plan,
+                           uint8_t image[SI5351_REG_IMAGE_SIZE]);
+
+/* registers that differ between two images, in register order; writes must
+ * have room for SI5351_REG_IMAGE_SIZE entries. Returns the number of writes
+ */
+int si5351_register_delta(const uint8_t old_image[SI5351_REG_IMAGE_SIZE],
+                          const uint8_t new_image[SI5351_REG_IMAGE_SIZE],
+                          struct si5351_reg_write *writes);
+
+void si5351_rational_approximation(double value, uint32_t max_denominator,
+                                   uint32_t *a, uint32_t *b, uint32_t *c);
+/* exact integer variant for num / den (den > 0, num / den < 2^32) */
+void si5351_rational_approximation_exact(uint64_t num, uint64_t den,
+                                         uint32_t max_denominator,
+                                         uint32_t *a, uint32_t *b, uint32_t *c);
+
+/* size is rounded up to a power of 2 */
+int si5351_cache_init(struct si5351_cache *cache, uint32_t size);
+void si5351_cache_free(struct si5351_cache *cache);
+/* the same with the entries from arena (si5351_cache_arena_size() bytes,
+ * and no si5351_cache_free(): they last until the arena is reset below
+ * them)
+ */
+int si5351_cache_init_arena(struct si5351_cache *cache, struct si5351_arena *arena,
+                            uint32_t size);
+size_t si5351_cache_arena_size(uint32_t size);
+
+void si5351_arena_init(struct si5351_arena *arena, void *buffer, size_t size);
+/* size bytes aligned for any type, NULL if the arena is full */
+void *si5351_arena_alloc(struct si5351_arena *arena, size_t size);
+/* si5351_rational_approximation_exact() through the cache */
+void si5351_cache_approximation(struct si5351_cache *cache,
+                                uint64_t num, uint64_t den,
+                                uint32_t max_denominator,
+                                uint32_t *a, uint32_t *b, uint32_t *c);
+
+/* 1 if the counters are compiled in */
+int si5351_stats_enabled(void);
+void si5351_stats_get(struct si5351_stats *stats);
+void si5351_stats_reset(void);
+void si5351_stats_add(struct si5351_stats *total, const struct si5351_stats *stats);
+
+const char *si5351_strerror(int status);
+
+#endif /* SI5351PLAN_H */
@@ -0,0 +1,73 @@
+/* Si5351 frequency planning library - quadrature outputs
+ *
+ * Copyright 2024, Franco Venturi, K4VZ
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <math.h>
+#include <stdint.h>
+
+#include "si5351plan.h"
+#include "si5351internal.h"
+
+/* AN619: CLKx_PHOFF delays clock x by PHOFF / (4 f_VCO) after a PLL
+ * reset, and is only exact when the output MS is an even integer. With
+ * both clocks at the same frequency the first scenario candidates (even
+ * integer output MS for clock 0, the same VCO for clock 1) already have
+ * the same output MS, so the search is the first scenario with the
+ * PHOFF, R divider and integer mode limits on top
+ */
+
+struct quadrature_search {
+    struct si5351_plan_result *best;
+    int found;
+};
+
+static void keep_quadrature(const struct si5351_plan_result *candidate, void *arg)
+{
+    struct quadrature_search *search = arg;
+    const struct si5351_ms *ms = candidate->output;
+    if (candidate->status != SI5351_OK || candidate->max_clk_diff == HUGE_VAL)
+        return;
+    if (ms[0].b != 0 || ms[0].a % 2 != 0 || ms[0].a > SI5351_MAX_PHOFF || candidate->rdiv[0] != 0)
+        return;
+    if (ms[1].a != ms[0].a || ms[1].b != 0 || candidate->rdiv[1] != 0)
+        return;
+
+    struct si5351_plan_quality quality;
+    si5351_plan_quality(candidate, &quality);
+    if (search->found && si5351_quality_compare(&quality, &search->best->quality) >= 0)
+        return;
+    *search->best = *candidate;
+    search->best->quality = quality;
+    search->found = 1;
+}
+
+int si5351_plan_quadrature(struct si5351_setup *setup, double xtal, double clk,
+                           struct si5351_quadrature *quadrature)
+{
+    const struct si5351_plan_request request = {xtal, 2, {clk, clk}};
+    int status = si5351_setup(setup, xtal, clk);
+    if (status != SI5351_OK)
+        return status;
+
+    struct quadrature_search search = {&quadrature->plan, 0};
+    status = si5351_plan_scenario1(setup, &request, keep_quadrature, &search);
+    if (status != SI5351_OK)
+        return status;
+    if (!search.found)
+        return SI5351_ERR_OUTPUT_MS;
+    quadrature->plan.status = SI5351_OK;
+    quadrature->phoff = (uint8_t)quadrature->plan.output[0].a;
+    return SI5351_OK;
+}
+
+int si5351_quadrature_writes(const struct si5351_quadrature *quadrature,
+                             struct si5351_reg_write writes[SI5351_QUADRATURE_WRITES])
+{
+    writes[0] = (struct si5351_reg_write){SI5351_REG_CLK0_PHOFF, 0};
+    writes[1] = (struct si5351_reg_write){SI5351_REG_CLK0_PHOFF + 1, quadrature->phoff};
+    writes[2] = (struct si5351_reg_write){SI5351_REG_PLL_RESET, SI5351_PLLA_RESET};
+    return SI5351_QUADRATURE_WRITES;
+}
@@ -0,0 +1,81 @@
+/* Si5351 frequency planning library - plan quality metrics
+ *
+ * Copyright 2024, Franco Venturi, K4VZ
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <math.h>
+#include <stdint.h>
+
+#include "si5351plan.h"
+#include "si5351internal.h"
+
+static uint8_t ms_class(const struct si5351_ms *ms)
+{
+    if (ms->b != 0)
+        return SI5351_MS_FRACTIONAL;
+    return ms->a % 2 ? SI5351_MS_ODD_INTEGER : SI5351_MS_EVEN_INTEGER;
+}
+
+static void count_ms(const struct si5351_ms *ms, uint8_t class,
+                     struct si5351_plan_quality *quality)
+{
+    if (class == SI5351_MS_FRACTIONAL) {
+        quality->nfractional++;
+        if (ms->c > quality->max_denominator)
+            quality->max_denominator = ms->c;
+    } else if (class == SI5351_MS_ODD_INTEGER) {
+        quality->nodd++;
+    }
+}
+
+void si5351_plan_quality(const struct si5351_plan_result *plan,
+                         struct si5351_plan_quality *quality)
+{
+    quality->max_ppb = plan->max_ppb;
+    quality->nfractional = 0;
+    quality->nodd = 0;
+    quality->max_denominator = 0;
+    quality->vco_margin = HUGE_VAL;
+
+    for (int pll = SI5351_PLLA; pll <= SI5351_PLLB; pll++) {
+        quality->feedback_class[pll] = SI5351_MS_EVEN_INTEGER;
+        double vco = plan->pll_freq[pll];
+        if (vco == 0)
+            continue;
+        quality->feedback_class[pll] = ms_class(&plan->feedback[pll]);
+        count_ms(&plan->feedback[pll], quality->feedback_class[pll], quality);
+        double margin = fmin(vco - SI5351_MIN_VCO_FREQ, SI5351_MAX_VCO_FREQ - vco);
+        if (margin < quality->vco_margin)
+            quality->vco_margin = margin;
+    }
+    if (quality->vco_margin == HUGE_VAL)
+        quality->vco_margin = 0;
+
+    for (int nclk = 0; nclk < SI5351_MAX_CLOCKS; nclk++) {
+        quality->ppb[nclk] = 0;
+        quality->output_class[nclk] = SI5351_MS_EVEN_INTEGER;
+        if (nclk >= plan->nclks || !plan->valid[nclk])
+            continue;
+        quality->ppb[nclk] = fabs(plan->clk_diff[nclk]) / plan->clks[nclk] * 1e9;
+        quality->output_class[nclk] = ms_class(&plan->output[nclk]);
+        count_ms(&plan->output[nclk], quality->output_class[nclk], quality);
+    }
+}
+
+int si5351_quality_compare(const struct si5351_plan_quality *q1,
+                           const struct si5351_plan_quality *q2)
+{
+    if (q1->max_ppb != q2->max_ppb)
+        return q1->max_ppb < q2->max_ppb ? -1 : 1;
+    int rank1 = 2 * q1->nfractional + q1->nodd;
+    int rank2 = 2 * q2->nfractional + q2->nodd;
+    if (rank1 != rank2)
+        return rank1 < rank2 ? -1 : 1;
+    if (q1->max_denominator != q2->max_denominator)
+        return q1->max_denominator < q2->max_denominator ? -1 : 1;
+    if (q1->vco_margin != q2->vco_margin)
+        return q1->vco_margin > q2->vco_margin ? -1 : 1;
+    return 0;
+}
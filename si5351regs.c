@@ -0,0 +1,113 @@
+/* Si5351 frequency planning library - AN619 register encoding
+ *
+ * Copyright 2024, Franco Venturi, K4VZ
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "si5351plan.h"
+#include "si5351internal.h"
+
+/* AN619 section 3.2 (feedback MS) and 4.1.2 (output MS):
+ *
+ *     P1 = 128 a + floor(128 b / c) - 512
+ *     P2 = 128 b - c floor(128 b / c)
+ *     P3 = c
+ *
+ * an output MS of 4 is encoded as P1 = P2 = 0, P3 = 1 with MSx_DIVBY4 = 11b
+ */
+void si5351_encode_ms(const struct si5351_ms *ms, struct si5351_ms_params *params)
+{
+    if (ms->a == 4 && ms->b == 0) {
+        params->p1 = 0;
+        params->p2 = 0;
+        params->p3 = 1;
+        return;
+    }
+    uint32_t f = (uint32_t)(((uint64_t)128 * ms->b) / ms->c);
+    params->p1 = 128 * ms->a + f - 512;
+    params->p2 = 128 * ms->b - ms->c * f;
+    params->p3 = ms->c;
+}
+
+/* AN619 registers 16-23: CLKx_PDN (7), MSx_INT (6), MSx_SRC (5), CLKx_INV
+ * (4), CLKx_SRC (3:2, 11b = MultiSynth), CLKx_IDRV (1:0, 11b = 8mA)
+ */
+uint8_t si5351_clock_control(const struct si5351_plan_result *plan, int nclk)
+{
+    const struct si5351_ms *ms = &plan->output[nclk];
+    uint8_t control = 0x0c | 0x03;
+    if (!si5351_integer_only(nclk) && ms->b == 0 && ms->a % 2 == 0)
+        control |= 0x40;
+    if (plan->pll[nclk] == SI5351_PLLB)
+        control |= 0x20;
+    return control;
+}
+
+/* 8 registers with the same layout for MSNA/MSNB and MS0-MS5 */
+static void encode_registers(const struct si5351_ms_params *params, uint8_t high,
+                             uint8_t *regs)
+{
+    regs[0] = (params->p3 >> 8) & 0xff;
+    regs[1] = params->p3 & 0xff;
+    regs[2] = high | ((params->p1 >> 16) & 0x03);
+    regs[3] = (params->p1 >> 8) & 0xff;
+    regs[4] = params->p1 & 0xff;
+    regs[5] = ((params->p3 >> 12) & 0xf0) | ((params->p2 >> 16) & 0x0f);
+    regs[6] = (params->p2 >> 8) & 0xff;
+    regs[7] = params->p2 & 0xff;
+}
+
+void si5351_register_image(const struct si5351_plan_result *plan,
+                           uint8_t image[SI5351_REG_IMAGE_SIZE])
+{
+    struct si5351_ms_params params;
+
+    /* unused PLLs and clocks stay all zeros */
+    memset(image, 0, SI5351_REG_IMAGE_SIZE);
+
+    for (int pll = SI5351_PLLA; pll <= SI5351_PLLB; pll++) {
+        if (plan->pll_freq[pll] == 0)
+            continue;
+        si5351_encode_ms(&plan->feedback[pll], &params);
+        encode_registers(&params, 0, &image[SI5351_REG_MSNA - SI5351_REG_IMAGE_FIRST + 8 * pll]);
+    }
+
+    for (int nclk = 0; nclk < plan->nclks; nclk++) {
+        const struct si5351_ms *ms = &plan->output[nclk];
+        /* Rx_DIV is 3 bits: the planners never go past R = 128 */
+        assert(plan->rdiv[nclk] <= 7);
+        if (si5351_integer_only(nclk)) {
+            /* MS6_P1/MS7_P1 is the divide ratio; R6_DIV in bits 2:0 and
+             * R7_DIV in bits 6:4 of the same register
+             */
+            int i = nclk - SI5351_FIRST_INTEGER_ONLY_CLOCK;
+            image[SI5351_REG_MS6 - SI5351_REG_IMAGE_FIRST + i] = (uint8_t)ms->a;
+            image[SI5351_REG_R6_R7 - SI5351_REG_IMAGE_FIRST] |= (uint8_t)(plan->rdiv[nclk] << (4 * i));
+            continue;
+        }
+        uint8_t divby4 = ms->a == 4 && ms->b == 0 ? 0x0c : 0x00;
+        si5351_encode_ms(ms, &params);
+        encode_registers(&params, (uint8_t)(plan->rdiv[nclk] << 4) | divby4,
+                         &image[SI5351_REG_MS0 - SI5351_REG_IMAGE_FIRST + 8 * nclk]);
+    }
+}
+
+int si5351_register_delta(const uint8_t old_image[SI5351_REG_IMAGE_SIZE],
+                          const uint8_t new_image[SI5351_REG_IMAGE_SIZE],
+                          struct si5351_reg_write *writes)
+{
+    int nwrites = 0;
+    for (int i = 0; i < SI5351_REG_IMAGE_SIZE; i++) {
+        if (old_image[i] == new_image[i])
+            continue;
+        writes[nwrites].reg = (uint8_t)(SI5351_REG_IMAGE_FIRST + i);
+        writes[nwrites].value = new_image[i];
+        nwrites++;
+    }
+    return nwrites;
+}
@@ -0,0 +1,217 @@
+/* Si5351 frequency planning library - incremental retune
+ *
+ * Copyright 2024, Franco Venturi, K4VZ
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <math.h>
+#include <stdint.h>
+
+#include "si5351plan.h"
+#include "si5351internal.h"
+
+/* each PLL of the previous plan is either kept as it is (only the output
+ * MS of its changed clocks are recomputed) or moved to the VCO frequency
+ * given by the previous integer output MS of one of its changed clocks
+ * (only the feedback MS and the output MS of its other clocks change);
+ * the cheapest of the two wins, keeping the PLL on ties. If the result is
+ * not within the error bound, this falls back to si5351_optimize()
+ */
+
+struct retune {
+    const struct si5351_optimize_options *options;
+    const struct si5351_plan_result *previous;
+    const struct si5351_plan_request *request;
+    struct si5351_cache *cache;
+    int exact;
+    double xtal;                        /* after CLKIN_DIV */
+    uint64_t xtal_hz;                   /* before CLKIN_DIV */
+    uint8_t clkin_div;
+    double r_clks[SI5351_MAX_CLOCKS];   /* clocks before the R divider */
+    uint64_t r_clks_hz[SI5351_MAX_CLOCKS];
+    uint8_t rdiv[SI5351_MAX_CLOCKS];
+};
+
+
+/* plan the clocks in mask on pll with feedback MS fb, where the clocks in
+ * keep reuse their previous output MS; returns the cost for this PLL
+ * (HUGE_VAL if invalid) and its max clock difference in *max_ppb
+ */
+static double plan_pll(const struct retune *rt, int pll, const struct si5351_ms *fb,
+                       unsigned mask, unsigned keep,
+                       struct si5351_plan_result *plan, double *max_ppb)
+{
+    const struct si5351_plan_request *request = rt->request;
+
+    if (!si5351_valid_feedback_ms(fb))
+        return HUGE_VAL;
+    double pll_freq = rt->xtal * si5351_ms_value(fb);
+    if (pll_freq < SI5351_MIN_VCO_FREQ || pll_freq > SI5351_MAX_VCO_FREQ)
+        return HUGE_VAL;
+    uint64_t pll_num = rt->xtal_hz * ((uint64_t)fb->a * fb->c + fb->b);
+    uint64_t pll_den = (uint64_t)fb->c << rt->clkin_div;
+
+    plan->pll_freq[pll] = pll_freq;
+    plan->feedback[pll] = *fb;
+
+    double penalty = si5351_ms_penalty(rt->options, fb);
+    *max_ppb = 0;
+    for (int nclk = 0; nclk < request->nclks; nclk++) {
+        if (!(mask & (1u << nclk)))
+            continue;
+        struct si5351_ms *ms = &plan->output[nclk];
+        if (keep & (1u << nclk)) {
+            *ms = rt->previous->output[nclk];
+        } else {
+            double ratio = pll_freq / rt->r_clks[nclk];
+            if (ratio < 4 || ratio > 901)
+                return HUGE_VAL;
+            si5351_approximate_output(nclk, rt->exact, rt->cache, pll_num, pll_den * rt->r_clks_hz[nclk], ratio, ms);
+        }
+        if (!si5351_valid_clock_ms(nclk, ms))
+            return HUGE_VAL;
+
+        double clk_diff = si5351_clock_diff(rt->exact, request->clks[nclk], rt->rdiv[nclk], pll_freq, pll_num, pll_den, ms);
+        double ppb = fabs(clk_diff) / request->clks[nclk] * 1e9;
+        if (ppb > *max_ppb)
+            *max_ppb = ppb;
+        penalty += si5351_ms_penalty(rt->options, ms);
+
+        plan->pll[nclk] = (uint8_t)pll;
+        plan->rdiv[nclk] = rt->rdiv[nclk];
+        plan->valid[nclk] = 1;
+        plan->clks[nclk] = request->clks[nclk];
+        plan->actual[nclk] = request->clks[nclk] + clk_diff;
+        plan->clk_diff[nclk] = clk_diff;
+    }
+    return *max_ppb + penalty;
+}
+
+static void copy_pll(const struct si5351_plan_result *from, int pll, unsigned mask,
+                     struct si5351_plan_result *to)
+{
+    to->pll_freq[pll] = from->pll_freq[pll];
+    to->feedback[pll] = from->feedback[pll];
+    for (int nclk = 0; nclk < SI5351_MAX_CLOCKS; nclk++) {
+        if (!(mask & (1u << nclk)))
+            continue;
+        to->pll[nclk] = from->pll[nclk];
+        to->output[nclk] = from->output[nclk];
+        to->rdiv[nclk] = from->rdiv[nclk];
+        to->valid[nclk] = from->valid[nclk];
+        to->clks[nclk] = from->clks[nclk];
+        to->actual[nclk] = from->actual[nclk];
+        to->clk_diff[nclk] = from->clk_diff[nclk];
+    }
+}
+
+
+int si5351_retune(struct si5351_setup *setup,
+                  const struct si5351_optimize_options *options,
+                  const struct si5351_plan_result *previous,
+                  const struct si5351_plan_request *request,
+                  struct si5351_plan_result *plan, int *pll_reset)
+{
+    if (request->nclks < 1 || request->nclks > SI5351_MAX_CLOCKS)
+        return SI5351_ERR_NCLKS;
+    int same_xtal = request->xtal == setup->xtal_orig;
+    int status = si5351_setup(setup, request->xtal, request->clks[0]);
+    if (status != SI5351_OK)
+        return status;
+
+    if (previous == NULL || !same_xtal || previous->nclks != request->nclks ||
+        previous->clkin_div != setup->clkin_div)
+        goto full;
+
+    struct retune rt = {
+        .options = options,
+        .previous = previous,
+        .request = request,
+        .cache = setup->cache,
+        .exact = si5351_is_integer_hz(request),
+        .xtal = setup->xtal,
+        .xtal_hz = (uint64_t)request->xtal,
+        .clkin_div = setup->clkin_div,
+    };
+    unsigned changed = 0;
+    for (int nclk = 0; nclk < request->nclks; nclk++) {
+        int rdiv = si5351_rdiv(request->clks[nclk], &rt.r_clks[nclk]);
+        if (rdiv < 0)
+            return SI5351_ERR_CLOCK_LOW;
+        rt.rdiv[nclk] = (uint8_t)rdiv;
+        rt.r_clks_hz[nclk] = (uint64_t)request->clks[nclk] << rdiv;
+        if (request->clks[nclk] != previous->clks[nclk] || rdiv != previous->rdiv[nclk])
+            changed |= 1u << nclk;
+    }
+
+    *plan = *previous;
+    *pll_reset = 0;
+    double max_ppb = 0;
+    double cost = 0;
+    for (int pll = SI5351_PLLA; pll <= SI5351_PLLB; pll++) {
+        unsigned mask = 0;
+        for (int nclk = 0; nclk < request->nclks; nclk++) {
+            if (previous->pll[nclk] == pll)
+                mask |= 1u << nclk;
+        }
+        if (mask == 0)
+            continue;
+
+        /* keep the PLL */
+        struct si5351_plan_result best;
+        double best_ppb;
+        double best_cost = plan_pll(&rt, pll, &previous->feedback[pll], mask, mask & ~changed, &best, &best_ppb);
+
+        /* move the PLL with the integer output MS of a changed clock */
+        for (int nclk = 0; nclk < request->nclks; nclk++) {
+            const struct si5351_ms *ms = &previous->output[nclk];
+            if (!(mask & changed & (1u << nclk)) || ms->b != 0 || rt.rdiv[nclk] != previous->rdiv[nclk])
+                continue;
+            struct si5351_ms fb;
+            uint64_t fb_num = (rt.r_clks_hz[nclk] * ms->a) << rt.clkin_div;
+            si5351_approximate(rt.exact, rt.cache, fb_num, rt.xtal_hz, rt.r_clks[nclk] * ms->a / rt.xtal, &fb);
+
+            struct si5351_plan_result moved;
+            double moved_ppb;
+            double moved_cost = plan_pll(&rt, pll, &fb, mask, 1u << nclk, &moved, &moved_ppb);
+            if (moved_cost < best_cost) {
+                best = moved;
+                best_ppb = moved_ppb;
+                best_cost = moved_cost;
+            }
+        }
+
+        if (best_cost == HUGE_VAL)
+            goto full;
+        copy_pll(&best, pll, mask, plan);
+        if (plan->feedback[pll].a != previous->feedback[pll].a)
+            *pll_reset = 1;
+        cost += best_cost - best_ppb;
+        max_ppb = fmax(max_ppb, best_ppb);
+    }
+
+    double max_ppb_bound = options->max_ppb > 0 ? options->max_ppb : SI5351_RETUNE_MAX_PPB;
+    if (max_ppb > max_ppb_bound)
+        goto full;
+
+    plan->status = SI5351_OK;
+    plan->max_ppb = max_ppb;
+    plan->cost = max_ppb + cost;
+    plan->max_clk_diff = 0;
+    for (int nclk = 0; nclk < request->nclks; nclk++)
+        plan->max_clk_diff = fmax(plan->max_clk_diff, fabs(plan->clk_diff[nclk]));
+    si5351_plan_quality(plan, &plan->quality);
+    return SI5351_OK;
+
+full:
+    {
+        struct si5351_optimize_options single = *options;
+        single.top_k = 1;
+        status = si5351_optimize(setup, request, &single, plan);
+        if (status < 0)
+            return status;
+        *pll_reset = 1;
+        return SI5351_OK;
+    }
+}
@@ -0,0 +1,189 @@
+/* Si5351 frequency planning library - reverse queries
+ *
+ * Copyright 2024, Franco Venturi, K4VZ
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "si5351plan.h"
+#include "si5351internal.h"
+
+/* the clock of feedback MS N and output MS M is CLKIN N / (M 2^rdiv): for
+ * a given M and R divider, the window maps to an interval of N, and only
+ * the fractions with a small denominator inside it need to be visited
+ */
+
+/* margin on the interval ends (the exact clock is checked afterwards) */
+static const double INTERVAL_MARGIN = 1e-9;
+/* clock errors (ppb) of plans that may have the same frequency */
+static const double SAME_PPB = 1e-6;
+
+void si5351_reverse_defaults(struct si5351_reverse_options *options)
+{
+    options->window = 1000;
+    options->max_feedback_denominator = 16;
+    options->max_output_denominator = 4;
+}
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+    while (b != 0) {
+        uint32_t r = a % b;
+        a = b;
+        b = r;
+    }
+    return a;
+}
+
+/* clock / CLKIN = num / den (both below 2^62 for the denominators of a
+ * query) to find the plans with the same frequency
+ */
+static void clock_ratio(const struct si5351_plan_result *plan, uint64_t *num, uint64_t *den)
+{
+    const struct si5351_ms *fb = &plan->feedback[SI5351_PLLA];
+    const struct si5351_ms *ms = &plan->output[0];
+    *num = ((uint64_t)fb->a * fb->c + fb->b) * ms->c;
+    *den = ((uint64_t)fb->c * ((uint64_t)ms->a * ms->c + ms->b)) << (plan->clkin_div + plan->rdiv[0]);
+}
+
+static int same_frequency(const struct si5351_plan_result *p1, const struct si5351_plan_result *p2)
+{
+    uint64_t num1, den1, num2, den2;
+    clock_ratio(p1, &num1, &den1);
+    clock_ratio(p2, &num2, &den2);
+    return (u128)num1 * den2 == (u128)num2 * den1;
+}
+
+/* insertion into results[0..n) sorted by quality; returns the new n */
+static int insert_result(struct si5351_plan_result *results, int n, int max_results,
+                         const struct si5351_plan_result *plan)
+{
+    /* a plan with the same frequency has the same clock error, so it is
+     * close to where plan goes
+     */
+    int i = n;
+    while (i > 0 && si5351_quality_compare(&plan->quality, &results[i - 1].quality) < 0)
+        i--;
+    for (int j = i - 1; j >= 0 && fabs(results[j].max_ppb - plan->max_ppb) < SAME_PPB; j--) {
+        if (same_frequency(&results[j], plan))
+            return n;
+    }
+    for (int j = i; j < n && fabs(results[j].max_ppb - plan->max_ppb) < SAME_PPB; j++) {
+        if (same_frequency(&results[j], plan)) {
+            memmove(&results[j], &results[j + 1], (n - j - 1) * sizeof(*results));
+            n--;
+            break;
+        }
+    }
+    if (i >= max_results)
+        return n;
+    if (n == max_results)
+        n--;
+    memmove(&results[i + 1], &results[i], (n - i) * sizeof(*results));
+    results[i] = *plan;
+    return n + 1;
+}
+
+/* the feedback MS values for output MS ms and R divider rdiv */
+static int walk_feedback(const struct si5351_setup *setup, double target,
+                         const struct si5351_reverse_options *options,
+                         const struct si5351_ms *ms, uint8_t rdiv,
+                         int max_results, struct si5351_plan_result *results, int n)
+{
+    int exact = setup->xtal_orig == floor(setup->xtal_orig) && target == floor(target) && target <= 4e9;
+    double divider = si5351_ms_value(ms) * (1 << rdiv);
+    double vco_min = fmax(SI5351_MIN_VCO_FREQ, (target - options->window) * divider);
+    double vco_max = fmin(SI5351_MAX_VCO_FREQ, (target + options->window) * divider);
+    double n_min = fmax(15, vco_min / setup->xtal);
+    double n_max = fmin(90, vco_max / setup->xtal);
+    if (n_min > n_max)
+        return n;
+
+    struct si5351_plan_result plan;
+    memset(&plan, 0, sizeof(plan));
+    plan.status = SI5351_OK;
+    plan.nclks = 1;
+    plan.clkin_div = setup->clkin_div;
+    plan.feedback[SI5351_PLLB] = (struct si5351_ms){0, 0, 1};
+    plan.pll[0] = SI5351_PLLA;
+    plan.output[0] = *ms;
+    plan.rdiv[0] = rdiv;
+    plan.valid[0] = 1;
+    plan.clks[0] = target;
+
+    uint32_t max_c = options->max_feedback_denominator;
+    for (uint32_t c = 1; c <= max_c; c++) {
+        uint64_t k_min = (uint64_t)ceil(n_min * c - INTERVAL_MARGIN);
+        uint64_t k_max = (uint64_t)floor(n_max * c + INTERVAL_MARGIN);
+        for (uint64_t k = k_min; k <= k_max; k++) {
+            if (c > 1 && gcd((uint32_t)(k % c), c) != 1)
+                continue;
+            struct si5351_ms *fb = &plan.feedback[SI5351_PLLA];
+            *fb = (struct si5351_ms){(uint32_t)(k / c), (uint32_t)(k % c), c};
+            if (!si5351_valid_feedback_ms(fb))
+                continue;
+            double vco = setup->xtal * ((double)k / c);
+            if (vco < SI5351_MIN_VCO_FREQ || vco > SI5351_MAX_VCO_FREQ)
+                continue;
+
+            uint64_t pll_num = (uint64_t)setup->xtal_orig * k;
+            uint64_t pll_den = (uint64_t)c << setup->clkin_div;
+            double clk_diff = si5351_clock_diff(exact, target, rdiv, vco, pll_num, pll_den, ms);
+            if (fabs(clk_diff) > options->window)
+                continue;
+            plan.pll_freq[SI5351_PLLA] = vco;
+            plan.actual[0] = target + clk_diff;
+            plan.clk_diff[0] = clk_diff;
+            plan.max_clk_diff = fabs(clk_diff);
+            plan.max_ppb = fabs(clk_diff) / target * 1e9;
+            plan.cost = plan.max_ppb;
+            si5351_plan_quality(&plan, &plan.quality);
+            n = insert_result(results, n, max_results, &plan);
+        }
+    }
+    return n;
+}
+
+int si5351_reverse_query(double xtal, double target,
+                         const struct si5351_reverse_options *options,
+                         int max_results, struct si5351_plan_result *results)
+{
+    struct si5351_setup setup = {0};
+    int status = si5351_setup(&setup, xtal, target - options->window);
+    if (status == SI5351_ERR_XTAL_RANGE)
+        return status;
+    if (options->window < 0 || options->max_feedback_denominator < 1 ||
+        options->max_output_denominator < 1 || max_results < 1)
+        return SI5351_ERR_NO_PLAN;
+    if (target - options->window <= 0)
+        return SI5351_ERR_CLOCK_LOW;
+
+    int n = 0;
+    for (uint8_t rdiv = 0; rdiv <= 7; rdiv++) {
+        /* output MS values that can reach the window from the VCO range */
+        double scale = (double)(1 << rdiv);
+        double ms_min = fmax(4, SI5351_MIN_VCO_FREQ / ((target + options->window) * scale));
+        double ms_max = fmin(900, SI5351_MAX_VCO_FREQ / ((target - options->window) * scale));
+        if (ms_min > ms_max)
+            continue;
+
+        for (uint32_t q = 1; q <= options->max_output_denominator; q++) {
+            for (uint32_t m = (uint32_t)floor(ms_min); m <= (uint32_t)ms_max; m++) {
+                for (uint32_t p = q == 1 ? 0 : 1; p < q; p++) {
+                    if (q > 1 && gcd(p, q) != 1)
+                        continue;
+                    struct si5351_ms ms = {m, p, q};
+                    double value = si5351_ms_value(&ms);
+                    if (value < ms_min || value > ms_max || !si5351_valid_output_ms(&ms))
+                        continue;
+                    n = walk_feedback(&setup, target, options, &ms, rdiv, max_results, results, n);
+                }
+            }
+        }
+    }
+    return n > 0 ? n : SI5351_ERR_NO_PLAN;
+}
@@ -0,0 +1,100 @@
+/* Si5351 frequency planning library - vectorized candidate prefilter
+ *
+ * Copyright 2024, Franco Venturi, K4VZ
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <stdint.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "si5351plan.h"
+#include "si5351internal.h"
+
+/* the scalar evaluation checks the output MS ratios of the approximated
+ * PLL frequency, which can differ from f_VCO by a few parts in 10^12;
+ * keep the candidates this close to the limits and let it decide
+ */
+static const double MARGIN = 1e-9;
+
+static int keep_candidate(double f_vco, double xtal, int nclks,
+                          const double *clks)
+{
+    double feedback_ms = f_vco / xtal;
+    if (f_vco < SI5351_MIN_VCO_FREQ || feedback_ms < 15 || feedback_ms > 90)
+        return 0;
+    for (int nclk = 1; nclk < nclks; nclk++) {
+        double ratio = f_vco / clks[nclk];
+        if (ratio < 4 * (1 - MARGIN) || ratio > 900 * (1 + MARGIN))
+            return 0;
+    }
+    return 1;
+}
+
+void si5351_prefilter_scenario1(const struct si5351_setup *setup,
+                                const struct si5351_plan_request *request,
+                                uint32_t output_ms, int ncandidates,
+                                uint8_t *keep)
+{
+    double xtal = setup->xtal;
+    double r_clk0 = setup->r_clk0;
+    int i = 0;
+
+#if defined(__AVX2__)
+    const __m256d step = _mm256_set_pd(-6, -4, -2, 0);
+    const __m256d vxtal = _mm256_set1_pd(xtal);
+    const __m256d min_vco = _mm256_set1_pd(SI5351_MIN_VCO_FREQ);
+    const __m256d min_fb = _mm256_set1_pd(15);
+    const __m256d max_fb = _mm256_set1_pd(90);
+    const __m256d min_ratio = _mm256_set1_pd(4 * (1 - MARGIN));
+    const __m256d max_ratio = _mm256_set1_pd(900 * (1 + MARGIN));
+    for (; i + 4 <= ncandidates; i += 4) {
+        __m256d ms = _mm256_add_pd(_mm256_set1_pd((double)output_ms - 2.0 * i), step);
+        __m256d f_vco = _mm256_mul_pd(ms, _mm256_set1_pd(r_clk0));
+        __m256d feedback_ms = _mm256_div_pd(f_vco, vxtal);
+        __m256d ok = _mm256_and_pd(_mm256_cmp_pd(f_vco, min_vco, _CMP_GE_OQ),
+                                   _mm256_and_pd(_mm256_cmp_pd(feedback_ms, min_fb, _CMP_GE_OQ),
+                                                 _mm256_cmp_pd(feedback_ms, max_fb, _CMP_LE_OQ)));
+        for (int nclk = 1; nclk < request->nclks; nclk++) {
+            __m256d ratio = _mm256_div_pd(f_vco, _mm256_set1_pd(request->clks[nclk]));
+            ok = _mm256_and_pd(ok, _mm256_and_pd(_mm256_cmp_pd(ratio, min_ratio, _CMP_GE_OQ),
+                                                 _mm256_cmp_pd(ratio, max_ratio, _CMP_LE_OQ)));
+        }
+        int mask = _mm256_movemask_pd(ok);
+        for (int lane = 0; lane < 4; lane++)
+            keep[i + lane] = (mask >> lane) & 1;
+    }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    const float64x2_t step = {0, -2};
+    const float64x2_t vxtal = vdupq_n_f64(xtal);
+    const float64x2_t min_vco = vdupq_n_f64(SI5351_MIN_VCO_FREQ);
+    const float64x2_t min_fb = vdupq_n_f64(15);
+    const float64x2_t max_fb = vdupq_n_f64(90);
+    const float64x2_t min_ratio = vdupq_n_f64(4 * (1 - MARGIN));
+    const float64x2_t max_ratio = vdupq_n_f64(900 * (1 + MARGIN));
+    for (; i + 2 <= ncandidates; i += 2) {
+        float64x2_t ms = vaddq_f64(vdupq_n_f64((double)output_ms - 2.0 * i), step);
+        float64x2_t f_vco = vmulq_f64(ms, vdupq_n_f64(r_clk0));
+        float64x2_t feedback_ms = vdivq_f64(f_vco, vxtal);
+        uint64x2_t ok = vandq_u64(vcgeq_f64(f_vco, min_vco),
+                                  vandq_u64(vcgeq_f64(feedback_ms, min_fb),
+                                            vcleq_f64(feedback_ms, max_fb)));
+        for (int nclk = 1; nclk < request->nclks; nclk++) {
+            float64x2_t ratio = vdivq_f64(f_vco, vdupq_n_f64(request->clks[nclk]));
+            ok = vandq_u64(ok, vandq_u64(vcgeq_f64(ratio, min_ratio),
+                                         vcleq_f64(ratio, max_ratio)));
+        }
+        keep[i] = vgetq_lane_u64(ok, 0) != 0;
+        keep[i + 1] = vgetq_lane_u64(ok, 1) != 0;
+    }
+#endif
+
+    /* scalar fallback and remainder */
+    for (; i < ncandidates; i++)
+        keep[i] = (uint8_t)keep_candidate(r_clk0 * (output_ms - 2 * i), xtal, request->nclks, request->clks);
+}
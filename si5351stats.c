@@ -0,0 +1,59 @@
+/* Si5351 frequency planning library - solver counters
+ *
+ * Copyright 2024, Franco Venturi, K4VZ
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "si5351plan.h"
+#include "si5351internal.h"
+
+/* the counters are per thread, so the hot path needs no atomics; each
+ * thread collects its own with si5351_stats_get() and the caller adds
+ * them up with si5351_stats_add()
+ */
+#ifdef SI5351_STATS
+_Thread_local struct si5351_stats si5351_thread_stats;
+#endif
+
+int si5351_stats_enabled(void)
+{
+#ifdef SI5351_STATS
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+void si5351_stats_get(struct si5351_stats *stats)
+{
+#ifdef SI5351_STATS
+    *stats = si5351_thread_stats;
+#else
+    memset(stats, 0, sizeof(*stats));
+#endif
+}
+
+void si5351_stats_reset(void)
+{
+#ifdef SI5351_STATS
+    memset(&si5351_thread_stats, 0, sizeof(si5351_thread_stats));
+#endif
+}
+
+void si5351_stats_add(struct si5351_stats *total, const struct si5351_stats *stats)
+{
+    total->approximations += stats->approximations;
+    total->exact_approximations += stats->exact_approximations;
+    total->cf_terms += stats->cf_terms;
+    total->semiconvergents += stats->semiconvergents;
+    total->candidates += stats->candidates;
+    total->rejected_prefilter += stats->rejected_prefilter;
+    total->rejected_feedback_ms += stats->rejected_feedback_ms;
+    total->rejected_output_ms += stats->rejected_output_ms;
+    total->optimizer_evaluations += stats->optimizer_evaluations;
+    total->optimizer_pruned += stats->optimizer_pruned;
+}
@@ -0,0 +1,104 @@
+/* Si5351 frequency planning library - precomputed plan tables
+ *
+ * Copyright 2024, Franco Venturi, K4VZ
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "si5351plan.h"
+#include "si5351internal.h"
+
+/* a table is a header followed by one fixed size record per grid point
+ * (start + i * step), in host byte order so it can be used directly from
+ * a memory mapped file or from a const array in flash
+ */
+
+static const char SI5351_TABLE_MAGIC[8] = "SI5351T";
+
+size_t si5351_table_size(uint32_t count)
+{
+    return sizeof(struct si5351_table_header) + (size_t)count * sizeof(struct si5351_table_record);
+}
+
+int si5351_table_build(struct si5351_setup *setup,
+                       const struct si5351_optimize_options *options,
+                       uint64_t xtal, uint64_t start, uint64_t step,
+                       uint32_t count, void *buffer)
+{
+    struct si5351_table_header *header = buffer;
+    struct si5351_table_record *records = (struct si5351_table_record *)(header + 1);
+
+    if (step == 0 || count == 0)
+        return SI5351_ERR_NO_PLAN;
+
+    memcpy(header->magic, SI5351_TABLE_MAGIC, sizeof(header->magic));
+    header->version = SI5351_TABLE_VERSION;
+    header->byte_order = SI5351_TABLE_BYTE_ORDER;
+    header->record_size = sizeof(struct si5351_table_record);
+    header->count = count;
+    header->xtal = xtal;
+    header->start = start;
+    header->step = step;
+
+    struct si5351_optimize_options single = *options;
+    single.top_k = 1;
+    single.plls = 1;
+
+    for (uint32_t i = 0; i < count; i++) {
+        struct si5351_table_record *record = &records[i];
+        struct si5351_plan_request request = {
+            .xtal = (double)xtal,
+            .nclks = 1,
+            .clks = {(double)(start + i * step)},
+        };
+        struct si5351_plan_result plan;
+
+        memset(record, 0, sizeof(*record));
+        int status = si5351_optimize(setup, &request, &single, &plan);
+        if (status < 0) {
+            if (status != SI5351_ERR_NO_PLAN && status != SI5351_ERR_CLOCK_LOW)
+                return status;
+            continue;
+        }
+        record->feedback = plan.feedback[SI5351_PLLA];
+        record->output = plan.output[0];
+        record->rdiv = plan.rdiv[0];
+        record->clkin_div = plan.clkin_div;
+        record->flags = SI5351_TABLE_VALID;
+        record->ppb = (float)(plan.clk_diff[0] / request.clks[0] * 1e9);
+    }
+    return SI5351_OK;
+}
+
+int si5351_table_check(const void *data, size_t size)
+{
+    const struct si5351_table_header *header = data;
+
+    if (size < sizeof(*header) ||
+        memcmp(header->magic, SI5351_TABLE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != SI5351_TABLE_VERSION ||
+        header->byte_order != SI5351_TABLE_BYTE_ORDER ||
+        header->record_size != sizeof(struct si5351_table_record) ||
+        header->step == 0 ||
+        size < si5351_table_size(header->count))
+        return SI5351_ERR_TABLE;
+    return SI5351_OK;
+}
+
+const struct si5351_table_record *si5351_table_lookup(const struct si5351_table_header *table,
+                                                      uint64_t freq)
+{
+    if (freq < table->start)
+        return NULL;
+    uint64_t i = (freq - table->start + table->step / 2) / table->step;
+    if (i >= table->count)
+        return NULL;
+    const struct si5351_table_record *record = (const struct si5351_table_record *)(table + 1) + i;
+    if (!(record->flags & SI5351_TABLE_VALID))
+        return NULL;
+    return record;
+}